@@ -196,6 +196,13 @@ struct Config {
     // false: foo($1)$0
     // true: foo(${1:int a}, ${2:int b})$0
     bool placeholder = true;
+
+    // Leave documentation and the parent context (detail when detailedLabel is
+    // true) out of completion replies and fill them in completionItem/resolve
+    // from the last completion. Large completion lists shrink considerably.
+    // Only takes effect if the client lists these properties in
+    // completionItem.resolveSupport.
+    bool resolve = true;
   } completion;
 
   struct Diagnostics {
@@ -216,6 +223,13 @@ struct Config {
     // Time to wait before computing diagnostics for textDocument/didSave.
     int onSave = 0;
 
+    // If a main file has at least this many lines, diagnostics after
+    // textDocument/didChange only parse the function bodies that overlap
+    // edited lines. Diagnostics in other function bodies are carried over from
+    // the previous run. A full parse follows each region parse after the
+    // onChange delay. 0: always parse the whole file.
+    int regionThreshold = 0;
+
     bool spellChecking = true;
 
     std::vector<std::string> whitelist;
@@ -260,10 +274,33 @@ struct Config {
     std::vector<std::string> initialBlacklist;
     std::vector<std::string> initialWhitelist;
 
+    // While completion, diagnostics or preamble builds for viewed files are
+    // pending, or within a second after textDocument/didChange, only this many
+    // indexer threads keep running. Requests for opened and saved files are
+    // throttled too. -1: no limit
+    int interactiveThreads = -1;
+
+    // Run indexer threads at the lowest OS scheduling priority, so that they
+    // yield to the editor and to completion. This also applies to indexing of
+    // opened and saved files.
+    bool lowPriority = false;
+
+    // If true, an opened file that has not been indexed is first indexed
+    // without the contents of its headers, so that declarations and references
+    // in the main file can be queried sooner. A complete pass follows in the
+    // background.
+    bool mainFileFirst = false;
+
     // If a variable initializer/macro replacement-list has fewer than this many
     // lines, include the initializer in detailed_name.
     int maxInitializerLines = 5;
 
+    // When names of no linkage are indexed, occurrences in implicit template
+    // instantiations are indexed for at most this many instantiations per
+    // translation unit and per template. 0: unlimited
+    int maxInstantiations = 0;
+    int maxInstantiationsPerTemplate = 0;
+
     // If not 0, a file will be indexed in each tranlation unit that includes
     // it.
     int multiVersion = 0;
@@ -290,12 +327,38 @@ struct Config {
 
     // Whether to reparse a file if write times of its dependencies have
     // changed. The file will always be reparsed if its own write time changes.
-    // 0: no, 1: only during initial load of project, 2: yes
+    // 0: no, 1: only during initial load of project, 2: yes, and when a file
+    // is saved or changed on disk, reparse the open files including it and
+    // the others when they are next queried
     int trackDependency = 2;
 
     std::vector<std::string> whitelist;
   } index;
 
+  struct Memory {
+    // Maximum number of glibc malloc arenas (M_ARENA_MAX). Each indexer thread
+    // otherwise gets its own arena, which fragments badly and keeps RSS well
+    // above the live heap. 0: allocator default.
+    int arenaMax = 0;
+
+    // Return free heap pages to the OS whenever RSS has grown by this many MiB
+    // since the last trim, including during the initial indexing.
+    // 0: only trim when the main loop becomes idle after indexing.
+    int trimGrowth = 512;
+
+    // Indexing is throttled to half of the indexer threads when RSS exceeds 90%
+    // of this many MiB and to one thread above it. Has no effect where the
+    // current RSS cannot be read (only Linux, macOS and Windows are
+    // supported). 0: no limit
+    int rssLimit = 0;
+
+    // When the main loop becomes idle with no indexing in progress, free
+    // interned strings (names, hovers, comments, arguments, paths) that are no
+    // longer referenced, at most every this many seconds (at least 60).
+    // 0: never free them
+    int reclaimStrings = 0;
+  } memory;
+
   struct Request {
     // If the document of a request has not been indexed, wait up to this many
     // milleseconds before reporting error.
@@ -304,6 +367,12 @@ struct Config {
 
   struct Session {
     int maxNum = 10;
+
+    // Build preambles ahead of time for up to this many files that are likely
+    // to be opened next: files with the stem of an opened file and targets of
+    // textDocument/definition. Only free session slots are used, and nothing
+    // is warmed while RSS is above 90% of memory.rssLimit. 0: off
+    int warmup = 0;
   } session;
 
   struct WorkspaceSymbol {
@@ -339,24 +408,26 @@ REFLECT_STRUCT(Config::Completion::Include, blacklist, maxPathSize,
                suffixWhitelist, whitelist);
 REFLECT_STRUCT(Config::Completion, caseSensitivity, detailedLabel,
                dropOldRequests, duplicateOptional, filterAndSort, include,
-               maxNum, placeholder);
+               maxNum, placeholder, resolve);
 REFLECT_STRUCT(Config::Diagnostics, blacklist, onChange, onOpen, onSave,
-               spellChecking, whitelist)
+               regionThreshold, spellChecking, whitelist)
 REFLECT_STRUCT(Config::Highlight, largeFileSize, lsRanges, blacklist, whitelist)
 REFLECT_STRUCT(Config::Index::Name, suppressUnwrittenScope);
 REFLECT_STRUCT(Config::Index, blacklist, comments, initialNoLinkage,
-               initialBlacklist, initialWhitelist, maxInitializerLines,
-               multiVersion, multiVersionBlacklist, multiVersionWhitelist, name,
-               onChange, parametersInDeclarations, threads, trackDependency,
-               whitelist);
+               initialBlacklist, initialWhitelist, interactiveThreads,
+               lowPriority, mainFileFirst, maxInitializerLines,
+               maxInstantiations, maxInstantiationsPerTemplate, multiVersion,
+               multiVersionBlacklist, multiVersionWhitelist, name, onChange,
+               parametersInDeclarations, threads, trackDependency, whitelist);
+REFLECT_STRUCT(Config::Memory, arenaMax, trimGrowth, rssLimit, reclaimStrings);
 REFLECT_STRUCT(Config::Request, timeout);
-REFLECT_STRUCT(Config::Session, maxNum);
+REFLECT_STRUCT(Config::Session, maxNum, warmup);
 REFLECT_STRUCT(Config::WorkspaceSymbol, caseSensitivity, maxNum, sort);
 REFLECT_STRUCT(Config::Xref, maxNum);
 REFLECT_STRUCT(Config, compilationDatabaseCommand, compilationDatabaseDirectory,
                cache, capabilities, clang, client, codeLens, completion,
-               diagnostics, highlight, index, request, session, workspaceSymbol,
-               xref);
+               diagnostics, highlight, index, memory, request, session,
+               workspaceSymbol, xref);
 
 extern Config *g_config;
 
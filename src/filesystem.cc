@@ -6,54 +6,177 @@ using namespace llvm;
 
 #include "utils.hh"
 
+#include <llvm/Config/llvm-config.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <set>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
+using ccls::DirectorySnapshot;
+
+namespace {
+using Listings =
+    std::unordered_map<std::string, const DirectorySnapshot::Dir *>;
+
+// Directory mtimes are only as fine as the file system's timestamps (2s on
+// FAT). A listing taken within that window of the mtime may miss changes that
+// left the mtime unchanged.
+constexpr std::chrono::seconds kMtimeGranularity(2);
+
+DirectorySnapshot::Dir
+listDirectory(const std::string &dir, const sys::fs::file_status &status,
+              const Listings &prev) {
+  DirectorySnapshot::Dir ret;
+  ret.path = dir;
+  ret.mtime = status.getLastModificationTime().time_since_epoch().count();
+  auto it = prev.find(dir);
+  if (it != prev.end() && it->second->mtime == ret.mtime &&
+      it->second->listed - ret.mtime >=
+          std::chrono::nanoseconds(kMtimeGranularity).count()) {
+    ret.listed = it->second->listed;
+    ret.files = it->second->files;
+    ret.dirs = it->second->dirs;
+    ret.links = it->second->links;
+    return ret;
+  }
+  sys::TimePoint<> now = std::chrono::system_clock::now();
+  ret.listed = now.time_since_epoch().count();
+
+  std::error_code ec;
+  sys::fs::file_status status1;
+  for (sys::fs::directory_iterator i(dir, ec, false), e; i != e && !ec;
+       i.increment(ec)) {
+    std::string name = sys::path::filename(i->path()).str();
+    if (name[0] == '.' && name != ".ccls")
+      continue;
+    // Use the file type from readdir if available to avoid a stat per entry.
+#if LLVM_VERSION_MAJOR >= 8
+    sys::fs::file_type type = i->type();
+#else
+    sys::fs::file_type type = sys::fs::file_type::type_unknown;
+#endif
+    if (type == sys::fs::file_type::type_unknown) {
+      if (sys::fs::status(i->path(), status1, false))
+        continue;
+      type = status1.type();
+    }
+    if (type == sys::fs::file_type::symlink_file)
+      ret.links.push_back(std::move(name));
+    else if (type == sys::fs::file_type::regular_file)
+      ret.files.push_back(std::move(name));
+    else if (type == sys::fs::file_type::directory_file)
+      ret.dirs.push_back(std::move(name));
+  }
+  return ret;
+}
+} // namespace
+
 void getFilesInFolder(std::string folder, bool recursive, bool dir_prefix,
-                      const std::function<void(const std::string &)> &handler) {
+                      const std::function<void(const std::string &)> &handler,
+                      DirectorySnapshot *snapshot) {
   ccls::ensureEndsInSlash(folder);
   sys::fs::file_status status;
   if (sys::fs::status(folder, status, true))
     return;
-  sys::fs::UniqueID id;
-  std::vector<std::string> curr{folder};
-  std::vector<std::pair<std::string, sys::fs::file_status>> succ;
-  std::set<sys::fs::UniqueID> seen{status.getUniqueID()};
-  while (curr.size() || succ.size()) {
-    if (curr.empty()) {
-      for (auto &it : succ)
-        if (!seen.count(it.second.getUniqueID()))
-          curr.push_back(std::move(it.first));
-      succ.clear();
-    } else {
-      std::error_code ec;
-      std::string folder1 = curr.back();
-      curr.pop_back();
-      for (sys::fs::directory_iterator i(folder1, ec, false), e; i != e && !ec;
-           i.increment(ec)) {
-        std::string path = i->path(), filename = sys::path::filename(path);
-        if ((filename[0] == '.' && filename != ".ccls") ||
-            sys::fs::status(path, status, false))
-          continue;
-        if (sys::fs::is_symlink_file(status)) {
-          if (sys::fs::status(path, status, true))
-            continue;
-          if (sys::fs::is_directory(status)) {
-            if (recursive)
-              succ.emplace_back(path, status);
+
+  Listings prev;
+  if (snapshot)
+    for (auto &dir : snapshot->dirs)
+      prev.emplace(dir.path, &dir);
+
+  std::mutex mtx;
+  std::condition_variable cv;
+  std::vector<std::string> pending{folder}, files;
+  // Directories reached through symbolic links. As in a sequential walk, they
+  // are queued after the real directories have been walked, so that a link
+  // into the tree does not replace the real path.
+  std::vector<std::pair<std::string, sys::fs::UniqueID>> linked;
+  std::vector<DirectorySnapshot::Dir> dirs;
+  std::set<sys::fs::UniqueID> seen;
+  int active = 0;
+
+  auto worker = [&]() {
+    std::vector<std::string> files1;
+    std::vector<DirectorySnapshot::Dir> dirs1;
+    std::unique_lock lock(mtx);
+    while (true) {
+      cv.wait(lock, [&] { return pending.size() || !active; });
+      if (pending.empty()) {
+        for (auto &[path, id] : linked)
+          if (!seen.count(id))
+            pending.push_back(std::move(path));
+        linked.clear();
+        if (pending.empty())
+          break;
+        cv.notify_all();
+      }
+      std::string dir = std::move(pending.back());
+      pending.pop_back();
+      active++;
+      lock.unlock();
+
+      sys::fs::file_status status1;
+      bool ok = !sys::fs::status(dir, status1, true);
+      lock.lock();
+      ok = ok && seen.insert(status1.getUniqueID()).second;
+      lock.unlock();
+      std::vector<std::string> subdirs;
+      std::vector<std::pair<std::string, sys::fs::UniqueID>> linked1;
+      if (ok) {
+        DirectorySnapshot::Dir listing = listDirectory(dir, status1, prev);
+        for (auto &name : listing.files)
+          files1.push_back(dir + name);
+        if (recursive)
+          for (auto &name : listing.dirs)
+            subdirs.push_back(dir + name + '/');
+        for (auto &name : listing.links) {
+          std::string path = dir + name;
+          if (sys::fs::status(path, status1, true))
             continue;
-          }
-        }
-        if (sys::fs::is_regular_file(status)) {
-          if (!dir_prefix)
-            path = path.substr(folder.size());
-          handler(sys::path::convert_to_slash(path));
-        } else if (recursive && sys::fs::is_directory(status) &&
-                   !seen.count(id = status.getUniqueID())) {
-          curr.push_back(path);
-          seen.insert(id);
+          if (sys::fs::is_regular_file(status1))
+            files1.push_back(path);
+          else if (recursive && sys::fs::is_directory(status1))
+            linked1.emplace_back(path + '/', status1.getUniqueID());
         }
+        if (snapshot)
+          dirs1.push_back(std::move(listing));
       }
+
+      lock.lock();
+      for (auto &path : subdirs)
+        pending.push_back(std::move(path));
+      for (auto &it : linked1)
+        linked.push_back(std::move(it));
+      active--;
+      cv.notify_all();
     }
+    files.insert(files.end(), std::make_move_iterator(files1.begin()),
+                 std::make_move_iterator(files1.end()));
+    dirs.insert(dirs.end(), std::make_move_iterator(dirs1.begin()),
+                std::make_move_iterator(dirs1.end()));
+  };
+
+  std::vector<std::thread> threads;
+  if (recursive)
+    for (unsigned i = 1,
+                  n = std::min(std::thread::hardware_concurrency(), 8u);
+         i < n; i++)
+      threads.emplace_back(worker);
+  worker();
+  for (auto &thread : threads)
+    thread.join();
+
+  if (snapshot)
+    snapshot->dirs = std::move(dirs);
+  std::sort(files.begin(), files.end());
+  for (std::string &path : files) {
+    if (!dir_prefix)
+      path = path.substr(folder.size());
+    handler(sys::path::convert_to_slash(path));
   }
 }
@@ -6,9 +6,32 @@
 #include <llvm/Support/FileSystem.h>
 #include <llvm/Support/Path.h>
 
+#include <cstdint>
 #include <functional>
 #include <string>
+#include <vector>
 
+namespace ccls {
+// Listing of the directories visited by getFilesInFolder. A directory whose
+// modification time is unchanged is not read again, unless it was listed
+// within the file system's timestamp granularity of that time.
+struct DirectorySnapshot {
+  struct Dir {
+    std::string path;
+    int64_t mtime = 0;
+    // When the directory was read, in the same unit as mtime.
+    int64_t listed = 0;
+    // Names of regular files, subdirectories and symbolic links.
+    std::vector<std::string> files, dirs, links;
+  };
+  std::vector<Dir> dirs;
+};
+} // namespace ccls
+
+// Directories are read in parallel. |handler| is called on the calling thread
+// in lexicographical order of paths. If |snapshot| is not null, unchanged
+// directories are taken from it and it is updated with the new listing.
 void getFilesInFolder(std::string folder, bool recursive,
                       bool add_folder_to_path,
-                      const std::function<void(const std::string &)> &handler);
+                      const std::function<void(const std::string &)> &handler,
+                      ccls::DirectorySnapshot *snapshot = nullptr);
@@ -21,9 +21,11 @@
 #include <llvm/Support/Path.h>
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <inttypes.h>
 #include <map>
-#include <unordered_set>
+#include <thread>
 
 using namespace clang;
 
@@ -52,7 +54,11 @@ struct IndexParam {
   VFS &vfs;
   ASTContext *ctx;
   bool no_linkage;
-  IndexParam(VFS &vfs, bool no_linkage) : vfs(vfs), no_linkage(no_linkage) {}
+  // If true, only the main file is indexed. Headers are recorded as
+  // dependencies but neither read nor stamped in |vfs|.
+  bool main_only;
+  IndexParam(VFS &vfs, bool no_linkage, bool main_only)
+      : vfs(vfs), no_linkage(no_linkage), main_only(main_only) {}
 
   void seenFile(FileID fid) {
     // If this is the first time we have seen the file (ignoring if we are
@@ -68,6 +74,8 @@ struct IndexParam {
       if (!it->second.mtime)
         if (auto tim = lastWriteTime(path))
           it->second.mtime = *tim;
+      if (main_only && fid != ctx->getSourceManager().getMainFileID())
+        return;
       if (std::optional<std::string> content = readContent(path))
         it->second.content = *content;
 
@@ -90,6 +98,51 @@ struct IndexParam {
         it.first->second = multiVersionMatcher->matches(pathFromFileEntry(*fe));
     return it.first->second;
   }
+
+  // Implicit instantiations within index.maxInstantiations* and their
+  // number per template.
+  llvm::DenseMap<const Decl *, bool> inst2indexed;
+  llvm::DenseMap<const Decl *, int> pattern2insts;
+  int insts = 0, elided_insts = 0, elided_refs = 0;
+
+  // Returns whether occurrences in |dc| should be indexed. Occurrences in
+  // implicit instantiations beyond the budget are not; references to the
+  // instantiations from non-template code still are.
+  bool indexInstantiation(const DeclContext *dc) {
+    const Decl *inst = nullptr, *pattern = nullptr;
+    for (; dc; dc = dc->getParent())
+      if (auto *fd = dyn_cast<FunctionDecl>(dc);
+          fd && fd->getTemplateSpecializationKind() ==
+                    TSK_ImplicitInstantiation) {
+        inst = fd;
+        pattern = fd->getTemplateInstantiationPattern();
+        break;
+      } else if (auto *rd = dyn_cast<CXXRecordDecl>(dc);
+                 rd && rd->getTemplateSpecializationKind() ==
+                           TSK_ImplicitInstantiation) {
+        inst = rd;
+        pattern = rd->getTemplateInstantiationPattern();
+        break;
+      }
+    if (!inst)
+      return true;
+    auto [it, inserted] = inst2indexed.try_emplace(inst, true);
+    if (inserted) {
+      int max = g_config->index.maxInstantiations,
+          max1 = g_config->index.maxInstantiationsPerTemplate;
+      int &n = pattern2insts[pattern ? pattern : inst];
+      if ((max && insts >= max) || (max1 && n >= max1)) {
+        it->second = false;
+        elided_insts++;
+      } else {
+        insts++;
+        n++;
+      }
+    }
+    if (!it->second)
+      elided_refs++;
+    return it->second;
+  }
 };
 
 StringRef getSourceInRange(const SourceManager &sm, const LangOptions &langOpts,
@@ -686,6 +739,8 @@ public:
         ;
       else
         return true;
+    } else if (!param.indexInstantiation(ast_node.ContainerDC)) {
+      return true;
     }
     SourceManager &sm = ctx->getSourceManager();
     const LangOptions &lang = ctx->getLangOpts();
@@ -1224,11 +1279,29 @@ std::string IndexFile::toString() {
   return ccls::serialize(SerializeFormat::Json, *this);
 }
 
+bool uniquifyLess(Usr a, Usr b) { return a < b; }
+bool uniquifyLess(const Use &a, const Use &b) {
+  // Consistent with Use::operator==, which ignores role.
+  return std::tie(a.range, a.file_id) < std::tie(b.range, b.file_id);
+}
+
+// Removes duplicates while keeping the first occurrence of each element.
 template <typename T> void uniquify(std::vector<T> &a) {
-  std::unordered_set<T> seen;
+  if (a.size() < 2)
+    return;
+  std::vector<uint32_t> order(a.size());
+  for (uint32_t i = 0; i < a.size(); i++)
+    order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [&](uint32_t i, uint32_t j) {
+    return uniquifyLess(a[i], a[j]);
+  });
+  std::vector<bool> dup(a.size());
+  for (size_t i = 1; i < order.size(); i++)
+    if (!uniquifyLess(a[order[i - 1]], a[order[i]]))
+      dup[order[i]] = true;
   size_t n = 0;
   for (size_t i = 0; i < a.size(); i++)
-    if (seen.insert(a[i]).second)
+    if (!dup[i])
       a[n++] = a[i];
   a.resize(n);
 }
@@ -1244,8 +1317,9 @@ index(SemaManager *manager, WorkingFiles *wfiles, VFS *vfs,
       const std::string &opt_wdir, const std::string &main,
       const std::vector<const char *> &args,
       const std::vector<std::pair<std::string, std::string>> &remapped,
-      bool no_linkage, bool &ok) {
+      bool no_linkage, bool &ok, bool main_only) {
   ok = true;
+  auto start = std::chrono::steady_clock::now();
   auto pch = std::make_shared<PCHContainerOperations>();
   llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> fs =
       llvm::vfs::getRealFileSystem();
@@ -1287,7 +1361,7 @@ index(SemaManager *manager, WorkingFiles *wfiles, VFS *vfs,
   clang->setSourceManager(new SourceManager(clang->getDiagnostics(),
                                             clang->getFileManager(), true));
 
-  IndexParam param(*vfs, no_linkage);
+  IndexParam param(*vfs, no_linkage, main_only);
 
   index::IndexingOptions indexOpts;
   indexOpts.SystemSymbolFilter =
@@ -1341,12 +1415,27 @@ index(SemaManager *manager, WorkingFiles *wfiles, VFS *vfs,
                  << (reason.empty() ? "" : ": " + reason);
     return {};
   }
+  if (param.elided_insts)
+    LOG_S(INFO) << "indexed " << param.insts << " implicit instantiations in "
+                << main << ", skipped " << param.elided_refs
+                << " occurrences in " << param.elided_insts << " others; took "
+                << std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now() - start)
+                       .count()
+                << "ms";
+
+  // Every file depends on all other files seen in the translation unit.
+  llvm::DenseMap<llvm::CachedHashStringRef, int64_t> all_deps;
+  std::vector<File *> files;
+  for (auto &[_, file] : param.uid2file) {
+    if (file.path.size() && file.path != main)
+      all_deps[llvm::CachedHashStringRef(intern(file.path))] = file.mtime;
+    if (file.db)
+      files.push_back(&file);
+  }
 
-  std::vector<std::unique_ptr<IndexFile>> result;
-  for (auto &it : param.uid2file) {
-    if (!it.second.db)
-      continue;
-    std::unique_ptr<IndexFile> &entry = it.second.db;
+  auto finish = [&](File &file) {
+    std::unique_ptr<IndexFile> &entry = file.db;
     entry->import_file = main;
     entry->args = args;
     for (auto &[_, it] : entry->uid2lid_and_path)
@@ -1369,18 +1458,32 @@ index(SemaManager *manager, WorkingFiles *wfiles, VFS *vfs,
       uniquify(it.second.uses);
 
     // Update dependencies for the file.
-    for (auto &[_, file] : param.uid2file) {
-      const std::string &path = file.path;
-      if (path.empty())
-        continue;
-      if (path == entry->path)
-        entry->mtime = file.mtime;
-      else if (path != entry->import_file)
-        entry->dependencies[llvm::CachedHashStringRef(intern(path))] =
-            file.mtime;
-    }
-    result.push_back(std::move(entry));
-  }
+    entry->mtime = file.mtime;
+    entry->dependencies = all_deps;
+    entry->dependencies.erase(llvm::CachedHashStringRef(file.path));
+    // Make the cache stale in case the complete pass does not happen.
+    if (main_only)
+      entry->mtime = 0;
+  };
+  // Files are independent, so post-process them in parallel when there are
+  // many, e.g. with index.multiVersion or a main file with many new headers.
+  std::atomic<size_t> next{0};
+  auto worker = [&]() {
+    for (size_t i; (i = next++) < files.size();)
+      finish(*files[i]);
+  };
+  std::vector<std::thread> threads;
+  if (files.size() >= 64)
+    for (unsigned i = 1, n = std::min(std::thread::hardware_concurrency(), 4u);
+         i < n; i++)
+      threads.emplace_back(worker);
+  worker();
+  for (auto &thread : threads)
+    thread.join();
+
+  std::vector<std::unique_ptr<IndexFile>> result;
+  for (File *file : files)
+    result.push_back(std::move(file->db));
 
   return result;
 }
@@ -333,7 +333,7 @@ index(SemaManager *complete, WorkingFiles *wfiles, VFS *vfs,
       const std::string &opt_wdir, const std::string &file,
       const std::vector<const char *> &args,
       const std::vector<std::pair<std::string, std::string>> &remapped,
-      bool all_linkages, bool &ok);
+      bool all_linkages, bool &ok, bool main_only = false);
 } // namespace idx
 } // namespace ccls
 
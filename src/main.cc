@@ -45,6 +45,10 @@ opt<std::string> opt_test_index("test-index", ValueOptional, init("!"),
 opt<std::string> opt_index("index",
                            desc("standalone mode: index a project and exit"),
                            value_desc("root"), cat(C));
+opt<int> opt_soak("soak",
+                  desc("with -index: simulate an editing session and report "
+                       "memory and latency drift"),
+                  value_desc("minutes"), init(0), cat(C));
 list<std::string> opt_init("init", desc("extra initialization options in JSON"),
                            cat(C));
 opt<std::string> opt_log_file("log-file", desc("stderr or log file"),
@@ -140,6 +144,8 @@ int main(int argc, char **argv) {
     if (opt_index.size()) {
       SmallString<256> root(opt_index);
       sys::fs::make_absolute(root);
+      if (opt_soak > 0)
+        return pipeline::soak(root.str(), opt_soak) ? 0 : 1;
       pipeline::standalone(root.str());
     } else {
       // The thread that reads from stdin and dispatchs commands to the main
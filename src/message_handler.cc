@@ -162,6 +162,7 @@ MessageHandler::MessageHandler() {
   bind("$ccls/navigate", &MessageHandler::ccls_navigate);
   bind("$ccls/reload", &MessageHandler::ccls_reload);
   bind("$ccls/vars", &MessageHandler::ccls_vars);
+  bind("completionItem/resolve", &MessageHandler::completionItem_resolve);
   bind("exit", &MessageHandler::exit);
   bind("initialize", &MessageHandler::initialize);
   bind("initialized", &MessageHandler::initialized);
@@ -234,6 +235,7 @@ void MessageHandler::run(InMessage &msg) {
 }
 
 QueryFile *MessageHandler::findFile(const std::string &path, int *out_file_id) {
+  pipeline::indexIfStale(path);
   QueryFile *ret = nullptr;
   auto it = db->name2file_id.find(lowerPathIfInsensitive(path));
   if (it != db->name2file_id.end()) {
@@ -274,7 +276,8 @@ void emitSkippedRanges(WorkingFile *wfile, QueryFile &file) {
   for (Range skipped : file.def->skipped_ranges)
     if (auto ls_skipped = getLsRange(wfile, skipped))
       params.skippedRanges.push_back(*ls_skipped);
-  pipeline::notify("$ccls/publishSkippedRanges", params);
+  pipeline::notifyIfChanged("$ccls/publishSkippedRanges", wfile->filename,
+                            params);
 }
 
 void emitSemanticHighlight(DB *db, WorkingFile *wfile, QueryFile &file) {
@@ -464,6 +467,7 @@ void emitSemanticHighlight(DB *db, WorkingFile *wfile, QueryFile &file) {
   for (auto &entry : grouped_symbols)
     if (entry.second.ranges.size() || entry.second.lsRanges.size())
       params.symbols.push_back(std::move(entry.second));
-  pipeline::notify("$ccls/publishSemanticHighlight", params);
+  pipeline::notifyIfChanged("$ccls/publishSemanticHighlight", wfile->filename,
+                            params);
 }
 } // namespace ccls
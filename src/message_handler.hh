@@ -18,6 +18,7 @@ limitations under the License.
 #include "lsp.hh"
 #include "query.hh"
 
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <optional>
@@ -121,6 +122,8 @@ struct CompletionItem {
   InsertTextFormat insertTextFormat = InsertTextFormat::PlainText;
   TextEdit textEdit;
   std::vector<TextEdit> additionalTextEdits;
+  // (completion id, candidate index) for completionItem/resolve.
+  std::optional<std::pair<int64_t, int>> data;
 
   std::vector<std::string> parameters_;
   int score_;
@@ -268,6 +271,7 @@ private:
   void ccls_navigate(JsonReader &, ReplyOnce &);
   void ccls_reload(JsonReader &);
   void ccls_vars(JsonReader &, ReplyOnce &);
+  void completionItem_resolve(CompletionItem &, ReplyOnce &);
   void exit(EmptyParam &);
   void initialize(JsonReader &, ReplyOnce &);
   void initialized(EmptyParam &);
@@ -303,6 +307,26 @@ private:
   void workspace_symbol(WorkspaceSymbolParam &, ReplyOnce &);
 };
 
+// Formatting requests and clang-format style cache statistics.
+struct FormatStats {
+  int64_t requests = 0, ms = 0, style_hits = 0, style_misses = 0;
+};
+extern FormatStats g_format_stats;
+
+// Completion latency and how many candidates were materialized as items.
+// Updated from the completion thread.
+struct CompletionStats {
+  std::atomic<int64_t> requests{0}, ms{0}, candidates{0}, built{0};
+  // Bytes of documentation and detail left to completionItem/resolve.
+  std::atomic<int64_t> resolves{0}, deferred_bytes{0};
+  // Signature help answered from the call site cache or by a parse.
+  std::atomic<int64_t> signature_hits{0}, signature_misses{0};
+};
+extern CompletionStats g_completion_stats;
+
+// Drop cached clang-format styles, e.g. after a .clang-format file changed.
+void clearFormatStyleCache();
+
 void emitSkippedRanges(WorkingFile *wfile, QueryFile &file);
 
 void emitSemanticHighlight(DB *db, WorkingFile *wfile, QueryFile &file);
@@ -15,8 +15,10 @@ limitations under the License.
 
 #include "message_handler.hh"
 #include "pipeline.hh"
+#include "platform.hh"
 #include "project.hh"
 #include "query.hh"
+#include "sema_manager.hh"
 
 namespace ccls {
 REFLECT_STRUCT(IndexInclude, line, resolved_path);
@@ -27,18 +29,61 @@ namespace {
 struct Out_cclsInfo {
   struct DB {
     int files, funcs, types, vars;
+    int64_t sharedRefs;
   } db;
+  struct Completion {
+    int64_t requests, ms, candidates, built, resolves, deferredBytes;
+    int64_t signatureHits, signatureMisses;
+  } completion;
+  struct Diagnostics {
+    int64_t fullRuns, fullMs, regionRuns, regionMs, skippedRuns;
+  } diagnostics;
+  struct Formatting {
+    int64_t requests, ms, styleHits, styleMisses;
+  } formatting;
+  struct Memory {
+    int64_t rss, peakRss, trims;
+    int64_t internedStrings, internedBytes, reclaimedStrings, reclaimedBytes;
+  } memory;
   struct Pipeline {
     int pendingIndexRequests;
+    int64_t dependentBatches, lastDependentBatchMs;
+    int64_t firstQueryMs, mainFileFirstQueryMs;
+    int64_t cacheLoaded, cacheLoadFilesPerSec;
+    int64_t vfsLocks, vfsContended;
+    int64_t applies, applyUs, applyMaxUs;
+    int64_t unchangedNotifications, unchangedNotificationBytes;
+    int64_t unchangedNotificationUs;
+    int64_t indexerLimit, indexerPauses, indexerPausedMs;
   } pipeline;
   struct Project {
     int entries;
+    int64_t realPathCalls, realPathResolves;
   } project;
+  struct Session {
+    int64_t warmBuilds, warmHits, warmCancelled;
+  } session;
 };
-REFLECT_STRUCT(Out_cclsInfo::DB, files, funcs, types, vars);
-REFLECT_STRUCT(Out_cclsInfo::Pipeline, pendingIndexRequests);
-REFLECT_STRUCT(Out_cclsInfo::Project, entries);
-REFLECT_STRUCT(Out_cclsInfo, db, pipeline, project);
+REFLECT_STRUCT(Out_cclsInfo::DB, files, funcs, types, vars, sharedRefs);
+REFLECT_STRUCT(Out_cclsInfo::Completion, requests, ms, candidates, built,
+               resolves, deferredBytes, signatureHits, signatureMisses);
+REFLECT_STRUCT(Out_cclsInfo::Diagnostics, fullRuns, fullMs, regionRuns,
+               regionMs, skippedRuns);
+REFLECT_STRUCT(Out_cclsInfo::Formatting, requests, ms, styleHits,
+               styleMisses);
+REFLECT_STRUCT(Out_cclsInfo::Memory, rss, peakRss, trims, internedStrings,
+               internedBytes, reclaimedStrings, reclaimedBytes);
+REFLECT_STRUCT(Out_cclsInfo::Pipeline, pendingIndexRequests, dependentBatches,
+               lastDependentBatchMs, firstQueryMs, mainFileFirstQueryMs,
+               cacheLoaded, cacheLoadFilesPerSec, vfsLocks, vfsContended,
+               applies, applyUs, applyMaxUs, unchangedNotifications,
+               unchangedNotificationBytes, unchangedNotificationUs,
+               indexerLimit, indexerPauses, indexerPausedMs);
+REFLECT_STRUCT(Out_cclsInfo::Project, entries, realPathCalls,
+               realPathResolves);
+REFLECT_STRUCT(Out_cclsInfo::Session, warmBuilds, warmHits, warmCancelled);
+REFLECT_STRUCT(Out_cclsInfo, db, completion, diagnostics, formatting, memory,
+               pipeline, project, session);
 } // namespace
 
 void MessageHandler::ccls_info(EmptyParam &, ReplyOnce &reply) {
@@ -47,10 +92,63 @@ void MessageHandler::ccls_info(EmptyParam &, ReplyOnce &reply) {
   result.db.funcs = db->funcs.size();
   result.db.types = db->types.size();
   result.db.vars = db->vars.size();
+  result.db.sharedRefs = db->shared_refs;
+  result.completion.requests = g_completion_stats.requests;
+  result.completion.ms = g_completion_stats.ms;
+  result.completion.candidates = g_completion_stats.candidates;
+  result.completion.built = g_completion_stats.built;
+  result.completion.resolves = g_completion_stats.resolves;
+  result.completion.deferredBytes = g_completion_stats.deferred_bytes;
+  result.completion.signatureHits = g_completion_stats.signature_hits;
+  result.completion.signatureMisses = g_completion_stats.signature_misses;
+  result.diagnostics.fullRuns = manager->full_diag_runs;
+  result.diagnostics.fullMs = manager->full_diag_ms;
+  result.diagnostics.regionRuns = manager->region_diag_runs;
+  result.diagnostics.regionMs = manager->region_diag_ms;
+  result.diagnostics.skippedRuns = manager->skipped_diag_runs;
+  result.formatting.requests = g_format_stats.requests;
+  result.formatting.ms = g_format_stats.ms;
+  result.formatting.styleHits = g_format_stats.style_hits;
+  result.formatting.styleMisses = g_format_stats.style_misses;
+  result.memory.rss = getResidentMemory();
+  result.memory.peakRss =
+      std::max<int64_t>(pipeline::peak_rss, result.memory.rss);
+  result.memory.trims = pipeline::trim_count;
+  std::tie(result.memory.internedStrings, result.memory.internedBytes) =
+      internedSize();
+  result.memory.reclaimedStrings = pipeline::reclaimed_strings;
+  result.memory.reclaimedBytes = pipeline::reclaimed_bytes;
   result.pipeline.pendingIndexRequests = pipeline::pending_index_requests;
+  result.pipeline.dependentBatches = pipeline::dependent_batches;
+  result.pipeline.lastDependentBatchMs = pipeline::dependent_ms;
+  result.pipeline.firstQueryMs = pipeline::first_query_ms;
+  result.pipeline.mainFileFirstQueryMs = pipeline::main_first_query_ms;
+  result.pipeline.cacheLoaded = pipeline::cache_loaded;
+  result.pipeline.cacheLoadFilesPerSec =
+      result.pipeline.cacheLoaded * 1000 /
+      std::max<int64_t>(pipeline::cache_load_ms, 1);
+  result.pipeline.vfsLocks = result.pipeline.vfsContended = 0;
+  for (auto &sh : vfs->shards) {
+    result.pipeline.vfsLocks += sh.locks;
+    result.pipeline.vfsContended += sh.contended;
+  }
+  result.pipeline.applies = pipeline::apply_count;
+  result.pipeline.applyUs = pipeline::apply_us;
+  result.pipeline.applyMaxUs = pipeline::apply_max_us;
+  result.pipeline.unchangedNotifications = pipeline::notify_skipped;
+  result.pipeline.unchangedNotificationBytes = pipeline::notify_skipped_bytes;
+  result.pipeline.unchangedNotificationUs = pipeline::notify_skipped_us;
+  result.pipeline.indexerLimit = pipeline::indexer_limit;
+  result.pipeline.indexerPauses = pipeline::indexer_pauses;
+  result.pipeline.indexerPausedMs = pipeline::indexer_paused_ms;
   result.project.entries = 0;
   for (auto &[_, folder] : project->root2folder)
     result.project.entries += folder.entries.size();
+  result.project.realPathCalls = real_path_calls;
+  result.project.realPathResolves = real_path_resolves;
+  result.session.warmBuilds = manager->warm_builds;
+  result.session.warmHits = manager->warm_hits;
+  result.session.warmCancelled = manager->warm_cancelled;
   reply(result);
 }
 
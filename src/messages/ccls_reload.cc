@@ -25,6 +25,7 @@ void MessageHandler::ccls_reload(JsonReader &reader) {
   reflect(reader, param);
   // Send index requests for every file.
   if (param.whitelist.empty() && param.blacklist.empty()) {
+    invalidateRealPath("");
     vfs->clear();
     db->clear();
     project->index(wfiles, RequestId());
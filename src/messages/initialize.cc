@@ -11,6 +11,7 @@
 #include "sema_manager.hh"
 #include "working_files.hh"
 
+#include <llvm/ADT/STLExtras.h>
 #include <llvm/ADT/Twine.h>
 #include <llvm/Support/Threading.h>
 
@@ -149,6 +150,12 @@ struct TextDocumentClientCap {
       // the end of the snippet. Placeholders with equal identifiers are linked,
       // that is typing in one will update others too.
       bool snippetSupport = false;
+
+      // Properties of a completion item the client can resolve lazily via
+      // completionItem/resolve.
+      struct ResolveSupport {
+        std::vector<std::string> properties;
+      } resolveSupport;
     } completionItem;
   } completion;
 
@@ -166,8 +173,11 @@ struct TextDocumentClientCap {
   } publishDiagnostics;
 };
 
+REFLECT_STRUCT(
+    TextDocumentClientCap::Completion::CompletionItem::ResolveSupport,
+    properties);
 REFLECT_STRUCT(TextDocumentClientCap::Completion::CompletionItem,
-               snippetSupport);
+               snippetSupport, resolveSupport);
 REFLECT_STRUCT(TextDocumentClientCap::Completion, completionItem);
 REFLECT_STRUCT(TextDocumentClientCap::DocumentSymbol,
                hierarchicalDocumentSymbolSupport);
@@ -250,7 +260,9 @@ void *indexer(void *arg_) {
   delete arg;
   std::string name = "indexer" + std::to_string(idx);
   set_thread_name(name.c_str());
-  pipeline::indexer_Main(h->manager, h->vfs, h->project, h->wfiles);
+  if (g_config->index.lowPriority)
+    lowerThreadPriority();
+  pipeline::indexer_Main(h->manager, h->vfs, h->project, h->wfiles, idx);
   pipeline::threadLeave();
   return nullptr;
 }
@@ -304,6 +316,14 @@ void do_initialize(MessageHandler *m, InitializeParam &param,
       capabilities.textDocument.completion.completionItem.snippetSupport;
   g_config->client.diagnosticsRelatedInformation &=
       capabilities.textDocument.publishDiagnostics.relatedInformation;
+  {
+    // Defer only what the client is known to resolve.
+    auto &props = capabilities.textDocument.completion.completionItem
+                      .resolveSupport.properties;
+    g_config->completion.resolve &=
+        is_contained(props, "documentation") &&
+        (!g_config->completion.detailedLabel || is_contained(props, "detail"));
+  }
   didChangeWatchedFiles =
       capabilities.workspace.didChangeWatchedFiles.dynamicRegistration;
 
@@ -321,6 +341,7 @@ void do_initialize(MessageHandler *m, InitializeParam &param,
   {
     InitializeResult result;
     auto &c = result.capabilities;
+    c.completionProvider.resolveProvider = g_config->completion.resolve;
     c.documentOnTypeFormattingProvider =
         g_config->capabilities.documentOnTypeFormattingProvider;
     c.foldingRangeProvider = g_config->capabilities.foldingRangeProvider;
@@ -362,6 +383,7 @@ void do_initialize(MessageHandler *m, InitializeParam &param,
       sys::fs::create_directories(g_config->cache.directory + '@' + escaped);
     }
 
+  setMallocArenaMax(g_config->memory.arenaMax);
   idx::init();
   for (auto &[folder, _] : workspaceFolders)
     m->project->load(folder);
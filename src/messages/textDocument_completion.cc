@@ -13,6 +13,12 @@
 #include <clang/Sema/Sema.h>
 #include <llvm/ADT/Twine.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string.h>
+#include <tuple>
+
 #if LLVM_VERSION_MAJOR < 8
 #include <regex>
 #endif
@@ -38,6 +44,24 @@ void reflect(JsonWriter &vis, CompletionItem &v) {
   REFLECT_MEMBER(textEdit);
   if (v.additionalTextEdits.size())
     REFLECT_MEMBER(additionalTextEdits);
+  if (v.data)
+    REFLECT_MEMBER(data);
+  reflectMemberEnd(vis);
+}
+
+// For completionItem/resolve, which sends back an item of ours.
+void reflect(JsonReader &vis, CompletionItem &v) {
+  reflectMemberStart(vis);
+  REFLECT_MEMBER(label);
+  REFLECT_MEMBER(kind);
+  REFLECT_MEMBER(detail);
+  REFLECT_MEMBER(documentation);
+  REFLECT_MEMBER(sortText);
+  REFLECT_MEMBER(filterText);
+  REFLECT_MEMBER(insertTextFormat);
+  REFLECT_MEMBER(textEdit);
+  REFLECT_MEMBER(additionalTextEdits);
+  REFLECT_MEMBER(data);
   reflectMemberEnd(vis);
 }
 
@@ -313,7 +337,7 @@ CompletionItemKind getCompletionKind(CodeCompletionContext::Kind k,
   }
 }
 
-void buildItem(const CodeCompletionResult &r, const CodeCompletionString &ccs,
+void buildItem(bool pattern, const CodeCompletionString &ccs,
                std::vector<CompletionItem> &out) {
   assert(!out.empty());
   auto first = out.size() - 1;
@@ -350,7 +374,7 @@ void buildItem(const CodeCompletionResult &r, const CodeCompletionString &ccs,
       // Duplicate last element, the recursive call will complete it.
       if (g_config->completion.duplicateOptional) {
         out.push_back(out.back());
-        buildItem(r, *chunk.Optional, out);
+        buildItem(pattern, *chunk.Optional, out);
       }
       continue;
     }
@@ -366,7 +390,7 @@ void buildItem(const CodeCompletionResult &r, const CodeCompletionString &ccs,
         continue;
 
       if (kind == CodeCompletionString::CK_Placeholder) {
-        if (r.Kind == CodeCompletionResult::RK_Pattern) {
+        if (pattern) {
           ignore = true;
           continue;
         }
@@ -388,13 +412,153 @@ void buildItem(const CodeCompletionResult &r, const CodeCompletionString &ccs,
     }
 }
 
+// A code completion result that has passed the availability checks. Full
+// CompletionItems are only built for candidates that rank high enough to be
+// returned. The strings are owned by the allocator of the consumer.
+struct CompletionCandidate {
+  const CodeCompletionString *ccs;
+  CompletionItemKind kind;
+  bool pattern;
+  StringRef typed_text;
+  std::vector<TextEdit> fixits;
+};
+
+// Fills the fields deferred to completionItem/resolve.
+void resolveItem(const CompletionCandidate &c, CompletionItem &item) {
+  if (const char *brief = c.ccs->getBriefComment())
+    item.documentation = brief;
+  if (item.detail.empty())
+    item.detail = c.ccs->getParentContextName().str();
+}
+
+void buildItems(const CompletionCandidate &c, std::pair<int64_t, int> data,
+                std::vector<CompletionItem> &ls_items) {
+  const CodeCompletionString &ccs = *c.ccs;
+  CompletionItem ls_item;
+  ls_item.kind = c.kind;
+  if (g_config->completion.resolve) {
+    ls_item.data = data;
+    if (const char *brief = ccs.getBriefComment())
+      g_completion_stats.deferred_bytes += strlen(brief);
+    if (g_config->completion.detailedLabel)
+      g_completion_stats.deferred_bytes += ccs.getParentContextName().size();
+  } else {
+    resolveItem(c, ls_item);
+  }
+
+  size_t first_idx = ls_items.size();
+  ls_items.push_back(ls_item);
+  buildItem(c.pattern, ccs, ls_items);
+
+  for (size_t j = first_idx; j < ls_items.size(); j++) {
+    std::string &s = ls_items[j].textEdit.newText;
+    if (!g_config->client.snippetSupport) {
+      if (s.size()) {
+        // Delete non-identifier parts.
+        if (s.back() == '(' || s.back() == '<')
+          s.pop_back();
+        else if (s.size() >= 2 && !s.compare(s.size() - 2, 2, "()"))
+          s.resize(s.size() - 2);
+      }
+    } else if (ls_items[j].insertTextFormat == InsertTextFormat::Snippet) {
+      if (!g_config->completion.placeholder) {
+        // foo(${1:int a}, ${2:int b}) -> foo($1)$0
+        auto p = s.find("${"), q = s.rfind('}');
+        s.replace(p, q - p + 1, "$1");
+      }
+      s += "$0";
+    }
+    ls_items[j].priority_ = ccs.getPriority();
+    if (!g_config->completion.detailedLabel) {
+      ls_items[j].detail = ls_items[j].label;
+      ls_items[j].label = ls_items[j].filterText;
+    }
+    ls_items[j].additionalTextEdits = c.fixits;
+  }
+}
+
+// Ranks candidates by the keys filterCandidates sorts on first (fixits, fuzzy
+// score of the typed text, priority) and builds items only for those that may
+// make it into the first completion.maxNum. Candidates tying with the last
+// survivor are kept so that the final order is the same as building all.
+// |truncated| is set if candidates were dropped for completion.maxNum.
+std::vector<CompletionItem>
+buildSurvivors(const std::vector<CompletionCandidate> &candidates, int64_t id,
+               const std::string &complete_text, bool &truncated) {
+  size_t max_num = g_config->completion.maxNum;
+  std::vector<CompletionItem> items;
+  truncated = false;
+  auto build = [&](const CompletionCandidate &c) {
+    buildItems(c, {id, int(&c - candidates.data())}, items);
+  };
+  if (!g_config->completion.filterAndSort) {
+    for (auto &c : candidates) {
+      if (items.size() >= max_num) {
+        truncated = true;
+        break;
+      }
+      build(c);
+    }
+    return items;
+  }
+
+  struct Ranked {
+    const CompletionCandidate *c;
+    int score;
+    std::tuple<size_t, int, unsigned> key() const {
+      return {c->fixits.size(), -score, c->ccs->getPriority()};
+    }
+  };
+  std::vector<Ranked> ranked;
+  ranked.reserve(candidates.size());
+  bool sensitive = g_config->completion.caseSensitivity;
+  FuzzyMatcher fuzzy(complete_text, sensitive);
+  for (auto &c : candidates) {
+    // Without a TypedText chunk the label is matched, which needs the item.
+    if (c.typed_text.empty()) {
+      build(c);
+      continue;
+    }
+    int score = 0;
+    if (complete_text.size()) {
+      std::string_view filter(c.typed_text.data(), c.typed_text.size());
+      score = reverseSubseqMatch(complete_text, filter, sensitive) >= 0
+                  ? fuzzy.match(filter, true)
+                  : FuzzyMatcher::kMinScore;
+      if (score <= FuzzyMatcher::kMinScore)
+        continue;
+    }
+    ranked.push_back({&c, score});
+  }
+
+  if (max_num && ranked.size() > max_num) {
+    std::nth_element(
+        ranked.begin(), ranked.begin() + (max_num - 1), ranked.end(),
+        [](const Ranked &l, const Ranked &r) { return l.key() < r.key(); });
+    auto last = ranked[max_num - 1].key();
+    auto it = std::remove_if(ranked.begin() + max_num, ranked.end(),
+                             [&](const Ranked &r) { return last < r.key(); });
+    truncated = it != ranked.end();
+    ranked.erase(it, ranked.end());
+  }
+  for (auto &r : ranked)
+    build(*r.c);
+  return items;
+}
+
 class CompletionConsumer : public CodeCompleteConsumer {
+public:
+  // Owns the strings of |candidates|, shared with the cache.
   std::shared_ptr<clang::GlobalCodeCompletionAllocator> alloc;
+
+private:
   CodeCompletionTUInfo cctu_info;
 
 public:
   bool from_cache;
-  std::vector<CompletionItem> ls_items;
+  // Identifies |candidates| in completionItem/resolve.
+  int64_t id = 0;
+  std::vector<CompletionCandidate> candidates;
 
   CompletionConsumer(const CodeCompleteOptions &opts, bool from_cache)
       :
@@ -412,7 +576,7 @@ public:
                                   unsigned numResults) override {
     if (context.getKind() == CodeCompletionContext::CCC_Recovery)
       return;
-    ls_items.reserve(numResults);
+    candidates.reserve(numResults);
     for (unsigned i = 0; i != numResults; i++) {
       auto &r = results[i];
       if (r.Availability == CXAvailability_NotAccessible ||
@@ -440,46 +604,16 @@ public:
       CodeCompletionString *ccs = r.CreateCodeCompletionString(
           s, context, getAllocator(), getCodeCompletionTUInfo(),
           includeBriefComments());
-      CompletionItem ls_item;
-      ls_item.kind = getCompletionKind(context.getKind(), r);
-      if (const char *brief = ccs->getBriefComment())
-        ls_item.documentation = brief;
-      ls_item.detail = ccs->getParentContextName().str();
-
-      size_t first_idx = ls_items.size();
-      ls_items.push_back(ls_item);
-      buildItem(r, *ccs, ls_items);
-
-      for (size_t j = first_idx; j < ls_items.size(); j++) {
-        std::string &s = ls_items[j].textEdit.newText;
-        if (!g_config->client.snippetSupport) {
-          if (s.size()) {
-            // Delete non-identifier parts.
-            if (s.back() == '(' || s.back() == '<')
-              s.pop_back();
-            else if (s.size() >= 2 && !s.compare(s.size() - 2, 2, "()"))
-              s.resize(s.size() - 2);
-          }
-        } else if (ls_items[j].insertTextFormat == InsertTextFormat::Snippet) {
-          if (!g_config->completion.placeholder) {
-            // foo(${1:int a}, ${2:int b}) -> foo($1)$0
-            auto p = s.find("${"), q = s.rfind('}');
-            s.replace(p, q - p + 1, "$1");
-          }
-          s += "$0";
-        }
-        ls_items[j].priority_ = ccs->getPriority();
-        if (!g_config->completion.detailedLabel) {
-          ls_items[j].detail = ls_items[j].label;
-          ls_items[j].label = ls_items[j].filterText;
-        }
-      }
+      CompletionCandidate &c = candidates.emplace_back();
+      c.ccs = ccs;
+      c.kind = getCompletionKind(context.getKind(), r);
+      c.pattern = r.Kind == CodeCompletionResult::RK_Pattern;
+      if (const char *typed = ccs->getTypedText())
+        c.typed_text = typed;
       for (const FixItHint &fixIt : r.FixIts) {
         auto &ast = s.getASTContext();
-        TextEdit ls_edit =
-            ccls::toTextEdit(ast.getSourceManager(), ast.getLangOpts(), fixIt);
-        for (size_t j = first_idx; j < ls_items.size(); j++)
-          ls_items[j].additionalTextEdits.push_back(ls_edit);
+        c.fixits.push_back(
+            ccls::toTextEdit(ast.getSourceManager(), ast.getLangOpts(), fixIt));
       }
     }
   }
@@ -487,11 +621,21 @@ public:
   CodeCompletionAllocator &getAllocator() override { return *alloc; }
   CodeCompletionTUInfo &getCodeCompletionTUInfo() override { return cctu_info; }
 };
+
+struct CachedCandidates {
+  std::shared_ptr<clang::GlobalCodeCompletionAllocator> alloc;
+  int64_t id = 0;
+  std::vector<CompletionCandidate> candidates;
+};
+
+CompleteConsumerCache<CachedCandidates> cache;
+std::atomic<int64_t> completion_id{0};
 } // namespace
 
+CompletionStats g_completion_stats;
+
 void MessageHandler::textDocument_completion(CompletionParam &param,
                                              ReplyOnce &reply) {
-  static CompleteConsumerCache<std::vector<CompletionItem>> cache;
   std::string path = param.textDocument.uri.getPath();
   WorkingFile *wf = wfiles->getFile(path);
   if (!wf) {
@@ -567,29 +711,50 @@ void MessageHandler::textDocument_completion(CompletionParam &param,
 #endif
 
   SemaManager::OnComplete callback =
-      [filter, path, begin_pos, end_pos, reply,
-       buffer_line](CodeCompleteConsumer *optConsumer) {
+      [filter, path, begin_pos, end_pos, reply, buffer_line,
+       start = std::chrono::steady_clock::now()](
+          CodeCompleteConsumer *optConsumer) {
         if (!optConsumer)
           return;
         auto *consumer = static_cast<CompletionConsumer *>(optConsumer);
-        CompletionList result;
-        result.items = consumer->ls_items;
-
-        filterCandidates(result, filter, begin_pos, end_pos, buffer_line);
-        reply(result);
+        // Update the cache first, completionItem/resolve may follow the reply
+        // immediately.
         if (!consumer->from_cache) {
+          consumer->id = ++completion_id;
           cache.withLock([&]() {
             cache.path = path;
             cache.line = buffer_line;
             cache.position = begin_pos;
-            cache.result = consumer->ls_items;
+            cache.result = {consumer->alloc, consumer->id,
+                            consumer->candidates};
           });
         }
+        CompletionList result;
+        bool truncated;
+        result.items = buildSurvivors(consumer->candidates, consumer->id,
+                                      filter, truncated);
+        g_completion_stats.candidates += consumer->candidates.size();
+        g_completion_stats.built += result.items.size();
+
+        filterCandidates(result, filter, begin_pos, end_pos, buffer_line);
+        // finalize only sees the survivors.
+        if (truncated)
+          result.isIncomplete = true;
+        reply(result);
+        g_completion_stats.requests++;
+        g_completion_stats.ms +=
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start)
+                .count();
       };
 
   if (cache.isCacheValid(path, buffer_line, begin_pos)) {
     CompletionConsumer consumer(ccOpts, true);
-    cache.withLock([&]() { consumer.ls_items = cache.result; });
+    cache.withLock([&]() {
+      consumer.alloc = cache.result.alloc;
+      consumer.id = cache.result.id;
+      consumer.candidates = cache.result.candidates;
+    });
     callback(&consumer);
   } else {
     manager->comp_tasks.pushBack(std::make_unique<SemaManager::CompTask>(
@@ -597,4 +762,18 @@ void MessageHandler::textDocument_completion(CompletionParam &param,
         std::make_unique<CompletionConsumer>(ccOpts, false), ccOpts, callback));
   }
 }
+
+void MessageHandler::completionItem_resolve(CompletionItem &param,
+                                            ReplyOnce &reply) {
+  // Items of an older completion cannot be resolved and are returned as is.
+  if (param.data)
+    cache.withLock([&]() {
+      auto [id, idx] = *param.data;
+      if (cache.result.id == id && idx >= 0 &&
+          idx < (int)cache.result.candidates.size())
+        resolveItem(cache.result.candidates[idx], param);
+    });
+  g_completion_stats.resolves++;
+  reply(param);
+}
 } // namespace ccls
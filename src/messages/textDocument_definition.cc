@@ -3,7 +3,9 @@
 
 #include "message_handler.hh"
 #include "query.hh"
+#include "sema_manager.hh"
 
+#include <algorithm>
 #include <ctype.h>
 #include <limits.h>
 #include <stdlib.h>
@@ -128,13 +130,17 @@ void MessageHandler::textDocument_definition(TextDocumentPositionParam &param,
           }
         }
       };
-      for (auto &func : db->funcs)
-        fn({func.usr, Kind::Func});
-      for (auto &type : db->types)
-        fn({type.usr, Kind::Type});
-      for (auto &var : db->vars)
-        if (var.def.size() && !var.def[0].is_local())
-          fn({var.usr, Kind::Var});
+      auto [it, end] = db->short_name2sym.equal_range(
+          hashUsr({short_query.data(), short_query.size()}));
+      for (; it != end; ++it) {
+        SymbolIdx sym = it->second;
+        if (sym.kind == Kind::Var) {
+          auto &var = db->getVar(sym);
+          if (var.def.empty() || var.def[0].is_local())
+            continue;
+        }
+        fn(sym);
+      }
 
       if (best_sym.kind != Kind::Invalid) {
         Maybe<DeclRef> dr = getDefinitionSpell(db, best_sym);
@@ -145,6 +151,17 @@ void MessageHandler::textDocument_definition(TextDocumentPositionParam &param,
     }
   }
 
+  // The user is likely to jump to the definition next.
+  if (g_config->session.warmup) {
+    std::vector<std::string> targets;
+    for (auto &loc : result) {
+      std::string path = DocumentUri{loc.targetUri}.getPath();
+      if (path != wf->filename &&
+          std::find(targets.begin(), targets.end(), path) == targets.end())
+        targets.push_back(std::move(path));
+    }
+    manager->warm(targets);
+  }
   reply.replyLocationLink(result);
 }
 
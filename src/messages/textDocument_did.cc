@@ -24,6 +24,7 @@ namespace ccls {
 void MessageHandler::textDocument_didChange(TextDocumentDidChangeParam &param) {
   std::string path = param.textDocument.uri.getPath();
   wfiles->onChange(param);
+  pipeline::markEdited();
   if (g_config->index.onChange)
     pipeline::index(path, {}, IndexMode::OnChange, true);
   manager->onView(path);
@@ -36,11 +37,13 @@ void MessageHandler::textDocument_didClose(TextDocumentParam &param) {
   wfiles->onClose(path);
   manager->onClose(path);
   pipeline::removeCache(path);
+  pipeline::forgetNotified(path);
 }
 
 void MessageHandler::textDocument_didOpen(DidOpenTextDocumentParam &param) {
   std::string path = param.textDocument.uri.getPath();
   WorkingFile *wf = wfiles->onOpen(param.textDocument);
+  pipeline::forgetNotified(path);
   if (std::optional<std::string> cached_file_contents =
           pipeline::loadIndexedContent(path))
     wf->setIndexContent(*cached_file_contents);
@@ -62,11 +65,14 @@ void MessageHandler::textDocument_didOpen(DidOpenTextDocumentParam &param) {
     project->indexRelated(path);
 
   manager->onView(path);
+  if (g_config->session.warmup)
+    manager->warm(project->relatedFiles(path));
 }
 
 void MessageHandler::textDocument_didSave(TextDocumentParam &param) {
   const std::string &path = param.textDocument.uri.getPath();
   pipeline::index(path, {}, IndexMode::Normal, false);
+  pipeline::indexDependents(db, project, wfiles, path);
   manager->onSave(path);
 }
 } // namespace ccls
@@ -19,16 +19,70 @@ limitations under the License.
 
 #include <clang/Format/Format.h>
 #include <clang/Tooling/Core/Replacement.h>
+#include <llvm/Support/Path.h>
+
+#include <chrono>
+#include <unordered_map>
 
 namespace ccls {
 using namespace clang;
 
+FormatStats g_format_stats;
+
 namespace {
-llvm::Expected<tooling::Replacements> formatCode(StringRef code, StringRef file,
-                                                 tooling::Range range) {
+struct CachedStyle {
+  format::FormatStyle style;
+  // .clang-format and _clang-format candidates from the directory up to the
+  // root, with their modification times (-1 if absent).
+  std::vector<std::pair<std::string, int64_t>> deps;
+};
+// Keyed by language and directory.
+std::unordered_map<std::string, CachedStyle> style_cache;
+
+llvm::Expected<format::FormatStyle> getStyle(StringRef code, StringRef file) {
+  format::FormatStyle::LanguageKind lang = format::guessLanguage(file, code);
+  std::string dir = llvm::sys::path::parent_path(file).str();
+  std::string key = std::to_string(lang) + dir;
+  auto it = style_cache.find(key);
+  if (it != style_cache.end()) {
+    bool valid = true;
+    for (auto &[path, mtime] : it->second.deps)
+      if (lastWriteTime(path).value_or(-1) != mtime) {
+        valid = false;
+        break;
+      }
+    if (valid) {
+      g_format_stats.style_hits++;
+      return it->second.style;
+    }
+    style_cache.erase(it);
+  }
+  g_format_stats.style_misses++;
+
+  CachedStyle entry;
+  for (StringRef cur = dir; cur.size(); cur = llvm::sys::path::parent_path(cur))
+    for (const char *name : {".clang-format", "_clang-format"}) {
+      SmallString<256> buf(cur);
+      llvm::sys::path::append(buf, name);
+      std::string path = buf.str().str();
+      entry.deps.emplace_back(path, lastWriteTime(path).value_or(-1));
+    }
   auto style = format::getStyle("file", file, "LLVM", code, nullptr);
   if (!style)
     return style.takeError();
+  entry.style = *style;
+  style_cache.emplace(std::move(key), std::move(entry));
+  return style;
+}
+
+llvm::Expected<tooling::Replacements> formatCode(StringRef code, StringRef file,
+                                                 tooling::Range range,
+                                                 bool sort_includes) {
+  auto style = getStyle(code, file);
+  if (!style)
+    return style.takeError();
+  if (!sort_includes)
+    return format::reformat(*style, code, {range}, file);
   tooling::Replacements includeReplaces =
       format::sortIncludes(*style, code, {range}, file);
   auto changed = tooling::applyAllReplacements(code, includeReplaces);
@@ -66,11 +120,18 @@ std::vector<TextEdit> replacementsToEdits(std::string_view code,
   return ret;
 }
 
-void format(ReplyOnce &reply, WorkingFile *wfile, tooling::Range range) {
+void format(ReplyOnce &reply, WorkingFile *wfile, tooling::Range range,
+            bool sort_includes = true) {
+  auto start = std::chrono::steady_clock::now();
   std::string_view code = wfile->buffer_content;
   auto replsOrErr = formatCode(
       StringRef(code.data(), code.size()),
-      StringRef(wfile->filename.data(), wfile->filename.size()), range);
+      StringRef(wfile->filename.data(), wfile->filename.size()), range,
+      sort_includes);
+  g_format_stats.requests++;
+  g_format_stats.ms += std::chrono::duration_cast<std::chrono::milliseconds>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
   if (replsOrErr)
     reply(replacementsToEdits(code, *replsOrErr));
   else
@@ -79,6 +140,8 @@ void format(ReplyOnce &reply, WorkingFile *wfile, tooling::Range range) {
 }
 } // namespace
 
+void clearFormatStyleCache() { style_cache.clear(); }
+
 void MessageHandler::textDocument_formatting(DocumentFormattingParam &param,
                                              ReplyOnce &reply) {
   auto [file, wf] = findOrFail(param.textDocument.uri.getPath(), reply);
@@ -98,7 +161,8 @@ void MessageHandler::textDocument_onTypeFormatting(
   auto lbrace = code.find_last_of('{', pos);
   if (lbrace == std::string::npos)
     lbrace = pos;
-  format(reply, wf, {(unsigned)lbrace, unsigned(pos - lbrace)});
+  // Include sorting is too expensive to run on every '}'.
+  format(reply, wf, {(unsigned)lbrace, unsigned(pos - lbrace)}, false);
 }
 
 void MessageHandler::textDocument_rangeFormatting(
@@ -105,17 +105,19 @@ void MessageHandler::textDocument_references(JsonReader &reader,
         path = include.resolved_path;
         break;
       }
-    if (path.size())
-      for (QueryFile &file1 : db->files)
-        if (file1.def)
-          for (const IndexInclude &include : file1.def->includes)
-            if (include.resolved_path == path) {
-              // Another file |file1| has the same include line.
-              Location &loc = result.emplace_back();
-              loc.uri = DocumentUri::fromPath(file1.def->path);
-              loc.range.start.line = loc.range.end.line = include.line;
-              break;
-            }
+    if (auto it = db->includers.find(path);
+        path.size() && it != db->includers.end()) {
+      int last_file_id = -1;
+      for (auto [file_id, line1] : it->second) {
+        // Another file has the same include line. Only report its first one.
+        if (file_id == last_file_id || !db->files[file_id].def)
+          continue;
+        last_file_id = file_id;
+        Location &loc = result.emplace_back();
+        loc.uri = DocumentUri::fromPath(db->files[file_id].def->path);
+        loc.range.start.line = loc.range.end.line = line1;
+      }
+    }
   }
 
   if ((int)result.size() >= g_config->xref.maxNum)
@@ -4,9 +4,17 @@
 #include "message_handler.hh"
 #include "pipeline.hh"
 #include "sema_manager.hh"
+#include "working_files.hh"
 
 #include <clang/Sema/Sema.h>
 
+#include <algorithm>
+#include <ctype.h>
+#include <mutex>
+#include <optional>
+#include <string.h>
+#include <string_view>
+
 namespace ccls {
 using namespace clang;
 
@@ -62,9 +70,8 @@ class SignatureHelpConsumer : public CodeCompleteConsumer {
   CodeCompletionTUInfo cCTUInfo;
 
 public:
-  bool from_cache;
   SignatureHelp ls_sighelp;
-  SignatureHelpConsumer(const clang::CodeCompleteOptions &opts, bool from_cache)
+  SignatureHelpConsumer(const clang::CodeCompleteOptions &opts)
       :
 #if LLVM_VERSION_MAJOR >= 9 // rC358696
         CodeCompleteConsumer(opts),
@@ -72,7 +79,7 @@ public:
         CodeCompleteConsumer(opts, false),
 #endif
         alloc(std::make_shared<GlobalCodeCompletionAllocator>()),
-        cCTUInfo(alloc), from_cache(from_cache) {
+        cCTUInfo(alloc) {
   }
   void ProcessOverloadCandidates(Sema &s, unsigned currentArg,
                                  OverloadCandidate *candidates,
@@ -139,40 +146,172 @@ public:
   CodeCompletionAllocator &getAllocator() override { return *alloc; }
   CodeCompletionTUInfo &getCodeCompletionTUInfo() override { return cCTUInfo; }
 };
+
+bool isIdentifierChar(char c) { return isalnum((unsigned char)c) || c == '_'; }
+
+// Returns the offset of the innermost unclosed '(' before |offset| and sets
+// |active| to the number of commas after it at the same level, or returns -1
+// if the cursor does not seem to be in an argument list. Comments, literals
+// and digit separators (1'000) are skipped.
+int findCallSite(std::string_view content, int offset, int &active) {
+  const int kMaxScan = 4096;
+  int i = std::max(0, offset - kMaxScan);
+  // Start at a line boundary to make it less likely to start inside a token.
+  if (size_t nl = content.find('\n', i); i > 0 && nl < size_t(offset))
+    i = nl + 1;
+  // (offset, number of commas) of unclosed brackets
+  std::vector<std::pair<int, int>> stack;
+  while (i < offset) {
+    char c = content[i];
+    char next = i + 1 < offset ? content[i + 1] : 0;
+    if (c == '/' && next == '/') {
+      size_t nl = content.find('\n', i);
+      if (nl >= size_t(offset))
+        return -1;
+      i = nl + 1;
+    } else if (c == '/' && next == '*') {
+      size_t end = content.find("*/", i + 2);
+      if (end == std::string_view::npos || end + 2 > size_t(offset))
+        return -1;
+      i = end + 2;
+    } else if (c == '"' && i > 0 && content[i - 1] == 'R') {
+      size_t lparen = content.find('(', i);
+      if (lparen >= size_t(offset))
+        return -1;
+      std::string close = ")";
+      close += content.substr(i + 1, lparen - i - 1);
+      close += '"';
+      size_t end = content.find(close, lparen);
+      if (end == std::string_view::npos ||
+          end + close.size() > size_t(offset))
+        return -1;
+      i = end + close.size();
+    } else if (c == '"' || c == '\'') {
+      for (i++; i < offset && content[i] != c && content[i] != '\n'; i++)
+        if (content[i] == '\\')
+          i++;
+      if (i >= offset)
+        return -1;
+      i++;
+    } else if ((isdigit((unsigned char)c) &&
+                !(i && isIdentifierChar(content[i - 1]))) ||
+               (c == '.' && isdigit((unsigned char)next))) {
+      // A pp-number, which may contain digit separators and exponent signs.
+      for (i++; i < offset; i++) {
+        char d = content[i];
+        if (d == '\'' && i + 1 < offset && isIdentifierChar(content[i + 1]))
+          i++;
+        else if ((d == '+' || d == '-') && content[i - 1] &&
+                 strchr("eEpP", content[i - 1]))
+          ;
+        else if (!isIdentifierChar(d) && d != '.')
+          break;
+      }
+    } else {
+      switch (c) {
+      case '(':
+      case '[':
+      case '{':
+        stack.emplace_back(i, 0);
+        break;
+      case ')':
+      case ']':
+      case '}':
+        if (stack.size())
+          stack.pop_back();
+        break;
+      case ',':
+        if (stack.size())
+          stack.back().second++;
+        break;
+      case ';':
+        stack.clear();
+        break;
+      }
+      i++;
+    }
+  }
+  if (stack.empty() || content[stack.back().first] != '(')
+    return -1;
+  active = stack.back().second;
+  return stack.back().first;
+}
+
+// Signature help of the last call site, identified by the offset of its '('.
+// The cache holds while no edit starts at or before the '(' (see
+// WorkingFile::firstEditSince). Moving within the argument list only changes
+// the active parameter, which findCallSite computes without a parse.
+struct SignatureCache {
+  std::mutex mutex;
+  std::string path;
+  int paren = -1;
+  int64_t seq = 0;
+  int active = 0;
+  SignatureHelp result;
+} cache;
+
+bool isVariadic(const SignatureInformation &sig) {
+  return sig.label.find("...") != std::string::npos;
+}
 } // namespace
 
 void MessageHandler::textDocument_signatureHelp(
     TextDocumentPositionParam &param, ReplyOnce &reply) {
-  static CompleteConsumerCache<SignatureHelp> cache;
-  Position begin_pos = param.position;
   std::string path = param.textDocument.uri.getPath();
   WorkingFile *wf = wfiles->getFile(path);
   if (!wf) {
     reply.notOpened(path);
     return;
   }
-  std::string buffer_line;
-  if (param.position.line >= 0 && param.position.line < wf->buffer_lines.size())
-    buffer_line = wf->buffer_lines[param.position.line];
-  {
-    std::string filter;
-    Position end_pos;
-    begin_pos = wf->getCompletionPosition(param.position, &filter, &end_pos);
+  int active = 0;
+  int paren = findCallSite(
+      wf->buffer_content,
+      getOffsetForPosition(param.position, wf->buffer_content), active);
+  int64_t seq = wf->editSeq();
+
+  // clang drops overloads that take fewer arguments than the current one, so
+  // a result computed at an earlier argument can be narrowed but not widened.
+  if (paren >= 0) {
+    std::optional<SignatureHelp> hit;
+    {
+      std::lock_guard lock(cache.mutex);
+      if (cache.path == path && cache.paren == paren &&
+          wf->firstEditSince(cache.seq) > paren && cache.active <= active) {
+        hit.emplace();
+        auto &sigs = cache.result.signatures;
+        for (size_t i = 0; i < sigs.size(); i++)
+          if (active == cache.active ||
+              int(sigs[i].parameters.size()) > active || isVariadic(sigs[i])) {
+            if (int(i) == cache.result.activeSignature)
+              hit->activeSignature = int(hit->signatures.size());
+            hit->signatures.push_back(sigs[i]);
+          }
+        hit->activeParameter = active;
+      }
+    }
+    if (hit) {
+      g_completion_stats.signature_hits++;
+      reply(*hit);
+      return;
+    }
   }
+  g_completion_stats.signature_misses++;
 
   SemaManager::OnComplete callback =
-      [reply, path, begin_pos, buffer_line](CodeCompleteConsumer *optConsumer) {
+      [reply, path, paren, seq, active](CodeCompleteConsumer *optConsumer) {
         if (!optConsumer)
           return;
         auto *consumer = static_cast<SignatureHelpConsumer *>(optConsumer);
         reply(consumer->ls_sighelp);
-        if (!consumer->from_cache) {
-          cache.withLock([&]() {
-            cache.path = path;
-            cache.line = buffer_line;
-            cache.position = begin_pos;
-            cache.result = consumer->ls_sighelp;
-          });
+        // Only cache call sites where the local argument count agrees with
+        // clang's, e.g. not when a template argument list contains a comma.
+        if (paren >= 0 && consumer->ls_sighelp.activeParameter == active) {
+          std::lock_guard lock(cache.mutex);
+          cache.path = path;
+          cache.paren = paren;
+          cache.seq = seq;
+          cache.active = active;
+          cache.result = consumer->ls_sighelp;
         }
       };
 
@@ -180,15 +319,8 @@ void MessageHandler::textDocument_signatureHelp(
   ccOpts.IncludeGlobals = false;
   ccOpts.IncludeMacros = false;
   ccOpts.IncludeBriefComments = true;
-  if (cache.isCacheValid(path, buffer_line, begin_pos)) {
-    SignatureHelpConsumer consumer(ccOpts, true);
-    cache.withLock([&]() { consumer.ls_sighelp = cache.result; });
-    callback(&consumer);
-  } else {
-    manager->comp_tasks.pushBack(std::make_unique<SemaManager::CompTask>(
-        reply.id, param.textDocument.uri.getPath(), param.position,
-        std::make_unique<SignatureHelpConsumer>(ccOpts, false), ccOpts,
-        callback));
-  }
+  manager->comp_tasks.pushBack(std::make_unique<SemaManager::CompTask>(
+      reply.id, param.textDocument.uri.getPath(), param.position,
+      std::make_unique<SignatureHelpConsumer>(ccOpts), ccOpts, callback));
 }
 } // namespace ccls
@@ -46,6 +46,12 @@ void MessageHandler::workspace_didChangeWatchedFiles(
     DidChangeWatchedFilesParam &param) {
   for (auto &event : param.changes) {
     std::string path = event.uri.getPath();
+    invalidateRealPath(path);
+    StringRef filename = sys::path::filename(path);
+    if (filename == ".clang-format" || filename == "_clang-format") {
+      clearFormatStyleCache();
+      continue;
+    }
     if ((g_config->cache.directory.size() &&
          StringRef(path).startswith(g_config->cache.directory)) ||
         lookupExtension(path).first == LanguageId::Unknown)
@@ -61,6 +67,7 @@ void MessageHandler::workspace_didChangeWatchedFiles(
           wfiles->getFile(path) ? IndexMode::Normal : IndexMode::Background;
       pipeline::index(path, {}, mode, true);
       if (event.type == FileChangeType::Changed) {
+        pipeline::indexDependents(db, project, wfiles, path);
         if (mode == IndexMode::Normal)
           manager->onSave(path);
         else
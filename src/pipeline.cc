@@ -17,12 +17,16 @@
 #include <rapidjson/document.h>
 #include <rapidjson/writer.h>
 
+#include <llvm/ADT/StringSet.h>
 #include <llvm/Support/Path.h>
 #include <llvm/Support/Process.h>
 #include <llvm/Support/Threading.h>
 
+#include <algorithm>
 #include <chrono>
+#include <inttypes.h>
 #include <mutex>
+#include <random>
 #include <shared_mutex>
 #include <thread>
 #ifndef _WIN32
@@ -41,18 +45,69 @@ REFLECT_STRUCT(PublishDiagnosticParam, uri, diagnostics);
 } // namespace
 
 void VFS::clear() {
-  std::lock_guard lock(mutex);
-  state.clear();
+  for (Shard &sh : shards) {
+    std::lock_guard lock(sh.mutex);
+    sh.state.clear();
+  }
+}
+
+VFS::Shard &VFS::shard(const std::string &path) {
+  return shards[std::hash<std::string>()(path) % kShards];
+}
+
+std::unique_lock<std::shared_mutex> VFS::lockShard(Shard &sh) {
+  sh.locks.fetch_add(1, std::memory_order_relaxed);
+  std::unique_lock lock(sh.mutex, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    sh.contended.fetch_add(1, std::memory_order_relaxed);
+    lock.lock();
+  }
+  return lock;
 }
 
-int VFS::loaded(const std::string &path) {
-  std::lock_guard lock(mutex);
-  return state[path].loaded;
+VFS::State VFS::get(const std::string &path) {
+  Shard &sh = shard(path);
+  sh.locks.fetch_add(1, std::memory_order_relaxed);
+  std::shared_lock lock(sh.mutex, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    sh.contended.fetch_add(1, std::memory_order_relaxed);
+    lock.lock();
+  }
+  auto it = sh.state.find(path);
+  return it != sh.state.end() ? it->second : State{};
 }
 
+int VFS::loaded(const std::string &path) { return get(path).loaded; }
+
 bool VFS::stamp(const std::string &path, int64_t ts, int step) {
-  std::lock_guard<std::mutex> lock(mutex);
-  State &st = state[path];
+  return update(path, [&](State &st) { return stampUnlocked(st, ts, step); });
+}
+
+std::vector<std::string>
+VFS::stamp(const decltype(IndexFile::dependencies) &deps, int step) {
+  std::vector<std::pair<Shard *, std::pair<std::string, int64_t>>> todo;
+  for (auto &[path, ts] : deps) {
+    std::string path1 = path.val().str();
+    Shard *sh = &shard(path1);
+    todo.push_back({sh, {std::move(path1), ts}});
+  }
+  std::sort(todo.begin(), todo.end(),
+            [](auto &l, auto &r) { return l.first < r.first; });
+  std::vector<std::string> ret;
+  std::unique_lock<std::shared_mutex> lock;
+  for (auto &[sh, p] : todo) {
+    if (lock.mutex() != &sh->mutex) {
+      if (lock)
+        lock.unlock();
+      lock = lockShard(*sh);
+    }
+    if (stampUnlocked(sh->state[p.first], p.second, step))
+      ret.push_back(std::move(p.first));
+  }
+  return ret;
+}
+
+bool VFS::stampUnlocked(State &st, int64_t ts, int step) {
   if (st.timestamp < ts || (st.timestamp == ts && st.step < step)) {
     st.timestamp = ts;
     st.step = step;
@@ -68,19 +123,48 @@ namespace pipeline {
 
 std::atomic<bool> g_quit;
 std::atomic<int64_t> loaded_ts{0}, pending_index_requests{0}, request_id{0};
+std::atomic<int64_t> peak_rss{0}, trim_count{0};
+std::atomic<int64_t> dependent_batches{0}, dependent_ms{0};
+std::atomic<int64_t> first_query_ms{0}, main_first_query_ms{0};
+std::atomic<int64_t> cache_loaded{0}, cache_load_ms{0};
+std::atomic<int64_t> apply_count{0}, apply_us{0}, apply_max_us{0};
+std::atomic<int64_t> notify_skipped{0}, notify_skipped_bytes{0},
+    notify_skipped_us{0};
+std::atomic<int64_t> indexer_limit{0}, indexer_pauses{0}, indexer_paused_ms{0};
+std::atomic<int64_t> reclaimed_strings{0}, reclaimed_bytes{0};
 int64_t tick = 0;
 
 namespace {
 
+// Translation units scheduled by indexDependents for one changed header.
+struct DependentBatch {
+  std::string path;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  std::atomic<int> remaining{0};
+};
+
 struct IndexRequest {
   std::string path;
   std::vector<const char *> args;
   IndexMode mode;
   bool must_exist = false;
   RequestId id;
+  std::shared_ptr<DependentBatch> batch;
+  // The complete pass following a main-file-only pass (index.mainFileFirst).
+  bool complete = false;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
   int64_t ts = tick++;
 };
 
+// Dependency of a translation unit whose cache is loaded, claimed by the
+// indexer that loaded the translation unit.
+struct CacheLoadRequest {
+  std::string path;
+  std::string root;
+  int entry_id;
+  bool priority;
+};
+
 std::mutex thread_mtx;
 std::condition_variable no_active_threads;
 int active_threads;
@@ -90,8 +174,11 @@ MultiQueueWaiter *indexer_waiter;
 MultiQueueWaiter *stdout_waiter;
 ThreadedQueue<InMessage> *on_request;
 ThreadedQueue<IndexRequest> *index_request;
+ThreadedQueue<CacheLoadRequest> *cache_load_request;
 ThreadedQueue<IndexUpdate> *on_indexed;
 ThreadedQueue<std::string> *for_stdout;
+// Bytes written to stdout and the time spent writing them.
+std::atomic<int64_t> stdout_bytes{0}, stdout_us{0};
 
 struct InMemoryIndexFile {
   std::string content;
@@ -100,16 +187,17 @@ struct InMemoryIndexFile {
 std::shared_mutex g_index_mutex;
 std::unordered_map<std::string, InMemoryIndexFile> g_index;
 
+// Held shared by indexers while they load or parse, when they hold interned
+// strings not yet reachable from DB or g_index.
+std::shared_mutex indexer_gate;
+
 bool cacheInvalid(VFS *vfs, IndexFile *prev, const std::string &path,
                   const std::vector<const char *> &args,
                   const std::optional<std::string> &from) {
-  {
-    std::lock_guard<std::mutex> lock(vfs->mutex);
-    if (prev->mtime < vfs->state[path].timestamp) {
-      LOG_V(1) << "timestamp changed for " << path
-               << (from ? " (via " + *from + ")" : std::string());
-      return true;
-    }
+  if (prev->mtime < vfs->get(path).timestamp) {
+    LOG_V(1) << "timestamp changed for " << path
+             << (from ? " (via " + *from + ")" : std::string());
+    return true;
   }
 
   // For inferred files, allow -o a a.cc -> -o b b.cc
@@ -182,12 +270,84 @@ std::unique_ptr<IndexFile> rawCacheLoad(const std::string &path) {
                            IndexFile::kMajorVersion);
 }
 
+std::atomic<int64_t> last_trim_rss{0};
+
+// Return free heap pages to the OS if RSS has grown by memory.trimGrowth MiB
+// since the last trim. If |force|, trim unconditionally.
+void reclaimMemory(bool force) {
+  int64_t rss = getResidentMemory();
+  for (int64_t peak = peak_rss.load(std::memory_order_relaxed);
+       rss > peak && !peak_rss.compare_exchange_weak(peak, rss);)
+    ;
+  if (!force) {
+    int64_t growth = int64_t(g_config->memory.trimGrowth) << 20,
+            last = last_trim_rss.load(std::memory_order_relaxed);
+    // Only one indexer thread performs the trim.
+    if (growth <= 0 || rss - last < growth ||
+        !last_trim_rss.compare_exchange_strong(last, rss))
+      return;
+  }
+  freeUnusedMemory();
+  int64_t after = getResidentMemory();
+  last_trim_rss = after;
+  trim_count++;
+  LOG_S(INFO) << "RSS " << (rss >> 20) << "MiB -> " << (after >> 20)
+              << "MiB after trimming";
+}
+
 std::mutex &getFileMutex(const std::string &path) {
   const int n_MUTEXES = 256;
   static std::mutex mutexes[n_MUTEXES];
   return mutexes[std::hash<std::string>()(path) % n_MUTEXES];
 }
 
+int64_t cache_load_start = 0;
+
+void countCacheLoad() {
+  int64_t now = chrono::duration_cast<chrono::milliseconds>(
+                    chrono::steady_clock::now().time_since_epoch())
+                    .count();
+  static std::once_flag once;
+  std::call_once(once, [&] { cache_load_start = now; });
+  cache_load_ms = now - cache_load_start;
+  cache_loaded++;
+}
+
+bool indexer_LoadCache(Project *project, VFS *vfs) {
+  std::optional<CacheLoadRequest> opt_request =
+      cache_load_request->tryPopFront();
+  if (!opt_request)
+    return false;
+  auto &request = *opt_request;
+  struct RAII {
+    ~RAII() { pending_index_requests--; }
+  } raii;
+
+  std::lock_guard lock(getFileMutex(request.path));
+  std::unique_ptr<IndexFile> prev = rawCacheLoad(request.path);
+  if (!prev)
+    return true;
+  if (!vfs->update(request.path, [&](VFS::State &st) {
+        if (st.loaded)
+          return false;
+        st.loaded++;
+        st.timestamp = prev->mtime;
+        if (prev->no_linkage)
+          st.step = 3;
+        return true;
+      }))
+    return true;
+  IndexUpdate update = IndexUpdate::createDelta(nullptr, prev.get());
+  on_indexed->pushBack(std::move(update), request.priority);
+  countCacheLoad();
+  if (request.entry_id >= 0) {
+    std::lock_guard lock1(project->mtx);
+    project->root2folder[request.root].path2entry_index[request.path] =
+        request.entry_id;
+  }
+  return true;
+}
+
 bool indexer_Parse(SemaManager *completion, WorkingFiles *wfiles,
                    Project *project, VFS *vfs, const GroupMatch &matcher) {
   std::optional<IndexRequest> opt_request = index_request->tryPopFront();
@@ -196,8 +356,20 @@ bool indexer_Parse(SemaManager *completion, WorkingFiles *wfiles,
   auto &request = *opt_request;
   bool loud = request.mode != IndexMode::OnChange;
   struct RAII {
-    ~RAII() { pending_index_requests--; }
-  } raii;
+    DependentBatch *batch;
+    ~RAII() {
+      pending_index_requests--;
+      if (batch && !--batch->remaining) {
+        int64_t ms = chrono::duration_cast<chrono::milliseconds>(
+                         chrono::steady_clock::now() - batch->start)
+                         .count();
+        dependent_batches++;
+        dependent_ms = ms;
+        LOG_S(INFO) << "reindexed dependents of " << batch->path << " in "
+                    << ms << "ms";
+      }
+    }
+  } raii{request.batch.get()};
 
   // Dummy one to trigger refresh semantic highlight.
   if (request.path.empty()) {
@@ -244,12 +416,16 @@ bool indexer_Parse(SemaManager *completion, WorkingFiles *wfiles,
     }
   }
 
+  auto resetStep = [](VFS::State &st) { st.step = 0; };
   if (g_config->index.onChange) {
     reparse = 2;
-    std::lock_guard lock(vfs->mutex);
-    vfs->state[path_to_index].step = 0;
+    vfs->update(path_to_index, resetStep);
     if (request.path != path_to_index)
-      vfs->state[request.path].step = 0;
+      vfs->update(request.path, resetStep);
+  }
+  if (request.complete) {
+    reparse = 2;
+    vfs->update(path_to_index, resetStep);
   }
   bool track = g_config->index.trackDependency > 1 ||
                (g_config->index.trackDependency == 1 && request.ts < loaded_ts);
@@ -291,41 +467,22 @@ bool indexer_Parse(SemaManager *completion, WorkingFiles *wfiles,
       IndexUpdate update = IndexUpdate::createDelta(nullptr, prev.get());
       on_indexed->pushBack(std::move(update),
                            request.mode != IndexMode::Background);
-      {
-        std::lock_guard lock1(vfs->mutex);
-        VFS::State &st = vfs->state[path_to_index];
+      countCacheLoad();
+      vfs->update(path_to_index, [&](VFS::State &st) {
         st.loaded++;
         if (prev->no_linkage)
           st.step = 2;
-      }
+      });
       lock.unlock();
 
-      for (const auto &dep : dependencies) {
-        std::string path = dep.first.val().str();
-        if (!vfs->stamp(path, dep.second, 1))
-          continue;
-        std::lock_guard lock1(getFileMutex(path));
-        prev = rawCacheLoad(path);
-        if (!prev)
-          continue;
-        {
-          std::lock_guard lock2(vfs->mutex);
-          VFS::State &st = vfs->state[path];
-          if (st.loaded)
-            continue;
-          st.loaded++;
-          st.timestamp = prev->mtime;
-          if (prev->no_linkage)
-            st.step = 3;
-        }
-        IndexUpdate update = IndexUpdate::createDelta(nullptr, prev.get());
-        on_indexed->pushBack(std::move(update),
-                             request.mode != IndexMode::Background);
-        if (entry.id >= 0) {
-          std::lock_guard lock2(project->mtx);
-          project->root2folder[entry.root].path2entry_index[path] = entry.id;
-        }
-      }
+      // Claim the dependencies under one lock so that each is loaded once,
+      // then let idle indexers load them in parallel.
+      bool priority = request.mode != IndexMode::Background;
+      std::vector<std::string> claimed = vfs->stamp(dependencies, 1);
+      pending_index_requests += claimed.size();
+      for (std::string &path : claimed)
+        cache_load_request->pushBack(
+            {std::move(path), entry.root, entry.id, priority}, priority);
       return true;
     } while (0);
 
@@ -339,6 +496,11 @@ bool indexer_Parse(SemaManager *completion, WorkingFiles *wfiles,
     LOG_S(INFO) << (deleted ? "delete " : "parse ") << path_to_index << line;
   }
 
+  // Whether nothing can be queried for the file until this request is done.
+  bool first = !deleted && request.mode == IndexMode::Normal &&
+               !request.complete && !vfs->loaded(path_to_index);
+  bool main_only = first && g_config->index.mainFileFirst &&
+                   request.path == path_to_index;
   std::vector<std::unique_ptr<IndexFile>> indexes;
   if (deleted) {
     indexes.push_back(std::make_unique<IndexFile>(request.path, "", false));
@@ -353,7 +515,8 @@ bool indexer_Parse(SemaManager *completion, WorkingFiles *wfiles,
     }
     bool ok;
     indexes = idx::index(completion, wfiles, vfs, entry.directory,
-                         path_to_index, entry.args, remapped, no_linkage, ok);
+                         path_to_index, entry.args, remapped, no_linkage, ok,
+                         main_only);
 
     if (!ok) {
       if (request.id.valid()) {
@@ -406,10 +569,7 @@ bool indexer_Parse(SemaManager *completion, WorkingFiles *wfiles,
       }
       on_indexed->pushBack(IndexUpdate::createDelta(prev.get(), curr.get()),
                            request.mode != IndexMode::Background);
-      {
-        std::lock_guard lock1(vfs->mutex);
-        vfs->state[path].loaded++;
-      }
+      vfs->update(path, [](VFS::State &st) { st.loaded++; });
       if (entry.id >= 0) {
         std::lock_guard lock(project->mtx);
         auto &folder = project->root2folder[entry.root];
@@ -419,6 +579,21 @@ bool indexer_Parse(SemaManager *completion, WorkingFiles *wfiles,
     }
   }
 
+  if (first) {
+    int64_t ms = chrono::duration_cast<chrono::milliseconds>(
+                     chrono::steady_clock::now() - request.start)
+                     .count();
+    (main_only ? main_first_query_ms : first_query_ms) = ms;
+    LOG_S(INFO) << path_to_index << " can be queried after " << ms << "ms"
+                << (main_only ? " (main file only)" : "");
+  }
+  if (main_only) {
+    pending_index_requests++;
+    IndexRequest next{request.path, request.args, IndexMode::Normal,
+                      request.must_exist};
+    next.complete = true;
+    index_request->pushBack(std::move(next), false);
+  }
   return true;
 }
 
@@ -427,6 +602,7 @@ void quit(SemaManager &manager) {
   manager.quit();
 
   { std::lock_guard lock(index_request->mutex_); }
+  { std::lock_guard lock(cache_load_request->mutex_); }
   indexer_waiter->cv.notify_all();
   { std::lock_guard lock(for_stdout->mutex_); }
   stdout_waiter->cv.notify_one();
@@ -454,24 +630,199 @@ void init() {
 
   indexer_waiter = new MultiQueueWaiter;
   index_request = new ThreadedQueue<IndexRequest>(indexer_waiter);
+  cache_load_request = new ThreadedQueue<CacheLoadRequest>(indexer_waiter);
 
   stdout_waiter = new MultiQueueWaiter;
   for_stdout = new ThreadedQueue<std::string>(stdout_waiter);
 }
 
+namespace {
+std::atomic<int64_t> last_edit_ms{0};
+
+int64_t steadyMs() {
+  return chrono::duration_cast<chrono::milliseconds>(
+             chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Returns how many indexer threads may run: fewer while RSS approaches
+// memory.rssLimit, and index.interactiveThreads while the user is typing or
+// SemaManager has pending work.
+int indexerLimit(SemaManager *manager) {
+  int n = g_config->index.threads;
+  if (int64_t limit = int64_t(g_config->memory.rssLimit) << 20) {
+    int64_t rss = getResidentMemory();
+    if (rss >= limit)
+      n = 1;
+    else if (rss >= limit / 10 * 9)
+      n = std::max(1, n / 2);
+  }
+  int interactive = g_config->index.interactiveThreads;
+  if (interactive >= 0 && n > interactive) {
+    // Warm preambles are built in the background and do not count.
+    bool pending = !manager->comp_tasks.isEmpty() ||
+                   !manager->diag_tasks.isEmpty() ||
+                   steadyMs() - last_edit_ms < 1000;
+    if (!pending)
+      manager->preamble_tasks.iterate(
+          [&](const SemaManager::PreambleTask &task) {
+            pending |= !task.warm;
+          });
+    if (pending)
+      n = interactive;
+  }
+  if (indexer_limit.exchange(n) != n)
+    LOG_V(1) << "run " << n << " indexers";
+  return n;
+}
+
+// Parks indexer |idx| while the governor allows no more than |idx| threads.
+void throttle(SemaManager *manager, int idx) {
+  if (idx < indexerLimit(manager))
+    return;
+  // This thread may have consumed the wakeup for a request that a running
+  // thread should take.
+  { std::lock_guard lock(index_request->mutex_); }
+  { std::lock_guard lock(cache_load_request->mutex_); }
+  indexer_waiter->cv.notify_all();
+  indexer_pauses++;
+  auto start = chrono::steady_clock::now();
+  do
+    std::this_thread::sleep_for(chrono::milliseconds(100));
+  while (!g_quit.load(std::memory_order_relaxed) &&
+         idx >= indexerLimit(manager));
+  indexer_paused_ms += chrono::duration_cast<chrono::milliseconds>(
+                           chrono::steady_clock::now() - start)
+                           .count();
+}
+} // namespace
+
+void markEdited() { last_edit_ms = steadyMs(); }
+
+namespace {
+int64_t last_collect_ms = 0;
+
+// Frees interned strings that are no longer referenced by DB, g_index, Project
+// or SemaManager sessions, at most every memory.reclaimStrings seconds unless
+// |force|. Skipped while indexers are working or requests or updates are
+// queued, as their strings are not reachable from these roots.
+void collectStrings(DB &db, Project &project, SemaManager &manager,
+                    bool force = false) {
+  int64_t interval =
+      std::max<int64_t>(g_config->memory.reclaimStrings, 60) * 1000;
+  if (!force && (!g_config->memory.reclaimStrings ||
+                 steadyMs() - last_collect_ms < interval))
+    return;
+  std::unique_lock gate(indexer_gate, std::try_to_lock);
+  if (!gate || !index_request->isEmpty() || !cache_load_request->isEmpty() ||
+      !on_indexed->isEmpty())
+    return;
+  last_collect_ms = steadyMs();
+
+  auto roots = [&](function_ref<void(const char *)> mark) {
+    auto markArgs = [&](const std::vector<const char *> &args) {
+      for (const char *arg : args)
+        mark(arg);
+    };
+    auto markDef = [&](const auto &def) {
+      mark(def.detailed_name);
+      mark(def.hover);
+      mark(def.comments);
+    };
+    for (auto &func : db.funcs)
+      for (auto &def : func.def)
+        markDef(def);
+    for (auto &type : db.types)
+      for (auto &def : type.def)
+        markDef(def);
+    for (auto &var : db.vars)
+      for (auto &def : var.def)
+        markDef(def);
+    for (auto &file : db.files)
+      if (file.def) {
+        markArgs(file.def->args);
+        for (auto &include : file.def->includes)
+          mark(include.resolved_path);
+        markArgs(file.def->dependencies);
+      }
+    {
+      std::shared_lock lock(g_index_mutex);
+      for (auto &it : g_index) {
+        const IndexFile &file = it.second.index;
+        for (auto &func : file.usr2func)
+          markDef(func.second.def);
+        for (auto &type : file.usr2type)
+          markDef(type.second.def);
+        for (auto &var : file.usr2var)
+          markDef(var.second.def);
+        markArgs(file.args);
+        for (auto &include : file.includes)
+          mark(include.resolved_path);
+        for (auto &dep : file.dependencies)
+          mark(dep.first.val().data());
+      }
+    }
+    {
+      std::lock_guard lock(project.mtx);
+      for (auto &it : project.root2folder) {
+        for (auto &entry : it.second.entries)
+          markArgs(entry.args);
+        for (auto &dot_ccls : it.second.dot_ccls)
+          markArgs(dot_ccls.second);
+      }
+    }
+    {
+      // Evicted sessions may still be used by SemaManager threads.
+      std::lock_guard lock(manager.mutex);
+      for (auto &weak : manager.live_sessions)
+        if (std::shared_ptr<Session> session = weak.lock())
+          markArgs(session->file.args);
+    }
+    markArgs(g_config->capabilities.documentOnTypeFormattingProvider
+                 .moreTriggerCharacter);
+  };
+  auto start = chrono::steady_clock::now();
+  auto [n, bytes] = collectInterned(roots);
+  gate.unlock();
+  int64_t ms = chrono::duration_cast<chrono::milliseconds>(
+                   chrono::steady_clock::now() - start)
+                   .count();
+
+  reclaimed_strings += n;
+  reclaimed_bytes += bytes;
+  LOG_IF_S(INFO, n) << "freed " << n << " interned strings ("
+                    << (bytes >> 10) << "KiB) in " << ms << "ms";
+  if (n)
+    reclaimMemory(true);
+}
+} // namespace
+
 void indexer_Main(SemaManager *manager, VFS *vfs, Project *project,
-                  WorkingFiles *wfiles) {
+                  WorkingFiles *wfiles, int idx) {
   GroupMatch matcher(g_config->index.whitelist, g_config->index.blacklist);
-  while (true)
-    if (!indexer_Parse(manager, wfiles, project, vfs, matcher))
-      if (indexer_waiter->wait(g_quit, index_request))
-        break;
+  while (true) {
+    throttle(manager, idx);
+    bool worked;
+    {
+      std::shared_lock lock(indexer_gate);
+      worked = indexer_LoadCache(project, vfs) ||
+               indexer_Parse(manager, wfiles, project, vfs, matcher);
+    }
+    if (worked)
+      reclaimMemory(false);
+    else if (indexer_waiter->wait(g_quit, cache_load_request, index_request))
+      break;
+  }
 }
 
 void main_OnIndexed(DB *db, WorkingFiles *wfiles, IndexUpdate *update) {
   if (update->refresh) {
     LOG_S(INFO)
         << "loaded project. Refresh semantic highlight for all working file.";
+    if (int64_t n = cache_loaded)
+      LOG_S(INFO) << "loaded " << n << " files from cache, "
+                  << n * 1000 / std::max<int64_t>(cache_load_ms, 1)
+                  << " files/s";
     std::lock_guard lock(wfiles->mutex);
     for (auto &[f, wf] : wfiles->files) {
       std::string path = lowerPathIfInsensitive(f);
@@ -483,7 +834,15 @@ void main_OnIndexed(DB *db, WorkingFiles *wfiles, IndexUpdate *update) {
     return;
   }
 
+  auto start = chrono::steady_clock::now();
   db->applyIndexUpdate(update);
+  int64_t us = chrono::duration_cast<chrono::microseconds>(
+                   chrono::steady_clock::now() - start)
+                   .count();
+  apply_count++;
+  apply_us += us;
+  if (us > apply_max_us)
+    apply_max_us = us;
 
   // Update indexed content, skipped ranges, and semantic highlighting.
   if (update->files_def_update) {
@@ -586,10 +945,17 @@ void launchStdout() {
 
     while (true) {
       std::vector<std::string> messages = for_stdout->dequeueAll();
+      auto start = chrono::steady_clock::now();
       for (auto &s : messages) {
         llvm::outs() << "Content-Length: " << s.size() << "\r\n\r\n" << s;
         llvm::outs().flush();
+        stdout_bytes.fetch_add(s.size(), std::memory_order_relaxed);
       }
+      if (messages.size())
+        stdout_us.fetch_add(chrono::duration_cast<chrono::microseconds>(
+                                chrono::steady_clock::now() - start)
+                                .count(),
+                            std::memory_order_relaxed);
       if (stdout_waiter->wait(g_quit, for_stdout))
         break;
     }
@@ -608,7 +974,7 @@ void mainLoop() {
         PublishDiagnosticParam params;
         params.uri = DocumentUri::fromPath(path);
         params.diagnostics = std::move(diagnostics);
-        notify("textDocument/publishDiagnostics", params);
+        notifyIfChanged("textDocument/publishDiagnostics", path, params);
       },
       [](const RequestId &id) {
         if (id.valid()) {
@@ -687,9 +1053,10 @@ void mainLoop() {
         break;
     } else {
       if (has_indexed) {
-        freeUnusedMemory();
+        reclaimMemory(true);
         has_indexed = false;
       }
+      collectStrings(db, project, manager);
       if (backlog.empty())
         main_waiter->wait(g_quit, on_indexed, on_request);
       else
@@ -700,24 +1067,35 @@ void mainLoop() {
   quit(manager);
 }
 
-void standalone(const std::string &root) {
+namespace {
+// The state of a server without a client, initialized for |root|.
+struct Standalone {
   Project project;
   WorkingFiles wfiles;
   VFS vfs;
-  SemaManager manager(
-      nullptr, nullptr,
+  SemaManager manager{
+      &project, &wfiles,
       [](const std::string &, const std::vector<Diagnostic> &) {},
-      [](const RequestId &id) {});
-  IncludeComplete complete(&project);
-
+      [](const RequestId &) {}};
+  IncludeComplete complete{&project};
+  DB db;
   MessageHandler handler;
-  handler.project = &project;
-  handler.wfiles = &wfiles;
-  handler.vfs = &vfs;
-  handler.manager = &manager;
-  handler.include_complete = &complete;
 
-  standaloneInitialize(handler, root);
+  Standalone(const std::string &root) {
+    handler.db = &db;
+    handler.project = &project;
+    handler.wfiles = &wfiles;
+    handler.vfs = &vfs;
+    handler.manager = &manager;
+    handler.include_complete = &complete;
+    standaloneInitialize(handler, root);
+  }
+};
+} // namespace
+
+void standalone(const std::string &root) {
+  Standalone st(root);
+  Project &project = st.project;
   bool tty = sys::Process::StandardOutIsDisplayed();
 
   if (tty) {
@@ -739,7 +1117,7 @@ void standalone(const std::string &root) {
   }
   if (tty)
     puts("");
-  quit(manager);
+  quit(st.manager);
 }
 
 void index(const std::string &path, const std::vector<const char *> &args,
@@ -749,6 +1127,64 @@ void index(const std::string &path, const std::vector<const char *> &args,
                           mode != IndexMode::Background);
 }
 
+namespace {
+// Accessed by the main thread only.
+// Changed file => dependents being reindexed for it. A save is reported by
+// both textDocument/didSave and workspace/didChangeWatchedFiles.
+StringMap<std::shared_ptr<DependentBatch>> header_batches;
+// Dependents that were not open when a file they include changed, reindexed
+// when next queried.
+StringSet<> stale_dependents;
+} // namespace
+
+void indexDependents(DB *db, Project *project, WorkingFiles *wfiles,
+                     const std::string &path) {
+  if (g_config->index.trackDependency < 2)
+    return;
+  for (auto it = header_batches.begin(); it != header_batches.end();) {
+    auto cur = it++;
+    if (!cur->second->remaining)
+      header_batches.erase(cur);
+  }
+  if (header_batches.count(path))
+    return;
+
+  // Open files are reindexed now, most recently edited first. The header
+  // itself is refreshed by the first translation unit parsed (VFS::stamp).
+  std::vector<std::pair<int64_t, std::string>> open;
+  int stale = 0;
+  for (int file_id : db->dependentRoots(path, [&](const std::string &path1) {
+         return project->isTranslationUnit(path1);
+       })) {
+    const std::string &path1 = db->files[file_id].def->path;
+    if (WorkingFile *wf = wfiles->getFile(path1))
+      open.emplace_back(wf->timestamp, path1);
+    else
+      stale += stale_dependents.insert(path1).second;
+  }
+  if (open.size() || stale)
+    LOG_S(INFO) << "reindex " << open.size() << " open dependents of " << path
+                << ", " << stale << " others when queried";
+  if (open.empty())
+    return;
+  std::sort(open.begin(), open.end(), std::greater<>());
+  auto batch = std::make_shared<DependentBatch>();
+  batch->path = path;
+  batch->remaining = open.size();
+  header_batches[path] = batch;
+  pending_index_requests += open.size();
+  for (auto &[ts, path1] : open) {
+    stale_dependents.erase(path1);
+    index_request->pushBack(
+        {path1, {}, IndexMode::Normal, true, {}, batch}, true);
+  }
+}
+
+void indexIfStale(const std::string &path) {
+  if (stale_dependents.size() && stale_dependents.erase(path))
+    index(path, {}, IndexMode::Normal, true);
+}
+
 void removeCache(const std::string &path) {
   if (g_config->cache.directory.size()) {
     std::lock_guard lock(g_index_mutex);
@@ -767,8 +1203,8 @@ std::optional<std::string> loadIndexedContent(const std::string &path) {
   return readContent(getCachePath(path));
 }
 
-void notifyOrRequest(const char *method, bool request,
-                     const std::function<void(JsonWriter &)> &fn) {
+static std::string makeMessage(const char *method, bool request,
+                               const std::function<void(JsonWriter &)> &fn) {
   rapidjson::StringBuffer output;
   rapidjson::Writer<rapidjson::StringBuffer> w(output);
   w.StartObject();
@@ -784,9 +1220,50 @@ void notifyOrRequest(const char *method, bool request,
   JsonWriter writer(&w);
   fn(writer);
   w.EndObject();
+  return output.GetString();
+}
+
+void notifyOrRequest(const char *method, bool request,
+                     const std::function<void(JsonWriter &)> &fn) {
+  std::string msg = makeMessage(method, request, fn);
   LOG_V(2) << (request ? "RequestMessage: " : "NotificationMessage: ")
            << method;
-  for_stdout->pushBack(output.GetString());
+  for_stdout->pushBack(std::move(msg));
+}
+
+namespace {
+std::mutex notified_mutex;
+// path => method => (hash, size) of the last notification sent
+std::unordered_map<std::string,
+                   std::unordered_map<std::string, std::pair<size_t, size_t>>>
+    notified;
+} // namespace
+
+void notifyIfChanged(const char *method, const std::string &path,
+                     const std::function<void(JsonWriter &)> &fn) {
+  std::string msg = makeMessage(method, false, fn);
+  std::pair<size_t, size_t> key{std::hash<std::string>()(msg), msg.size()};
+  {
+    std::lock_guard lock(notified_mutex);
+    auto [it, inserted] = notified[path].try_emplace(method, key);
+    if (!inserted && it->second == key) {
+      notify_skipped++;
+      notify_skipped_bytes += msg.size();
+      // Charge the skipped bytes at the measured cost of writing to stdout.
+      if (int64_t bytes = stdout_bytes.load(std::memory_order_relaxed))
+        notify_skipped_us += int64_t(msg.size()) *
+                             stdout_us.load(std::memory_order_relaxed) / bytes;
+      return;
+    }
+    it->second = key;
+  }
+  LOG_V(2) << "NotificationMessage: " << method;
+  for_stdout->pushBack(std::move(msg));
+}
+
+void forgetNotified(const std::string &path) {
+  std::lock_guard lock(notified_mutex);
+  notified.erase(path);
 }
 
 static void reply(const RequestId &id, const char *key,
@@ -825,5 +1302,264 @@ void replyError(const RequestId &id,
                 const std::function<void(JsonWriter &)> &fn) {
   reply(id, "error", fn);
 }
+
+namespace {
+// Builds a message as the stdin thread would receive it from the client.
+InMessage parseMessage(const char *method, bool request,
+                       const std::function<void(JsonWriter &)> &fn) {
+  std::string str = makeMessage(method, request, fn);
+  InMessage msg;
+  msg.message = std::make_unique<char[]>(str.size());
+  std::copy(str.begin(), str.end(), msg.message.get());
+  msg.document = std::make_unique<rapidjson::Document>();
+  msg.document->Parse(msg.message.get(), str.size());
+  JsonReader reader{msg.document.get()};
+  reflectMember(reader, "id", msg.id);
+  reflectMember(reader, "method", msg.method);
+  msg.deadline = chrono::steady_clock::now();
+  return msg;
+}
+
+void writeDocument(JsonWriter &w, const std::string &uri, int version = -1) {
+  w.key("textDocument");
+  w.startObject();
+  w.key("uri");
+  w.string(uri.c_str(), uri.size());
+  if (version >= 0) {
+    w.key("version");
+    w.int64(version);
+  }
+  w.endObject();
+}
+
+void writeChanges(JsonWriter &w, const std::vector<std::string> &uris) {
+  w.key("changes");
+  w.startArray();
+  for (auto &uri : uris) {
+    w.startObject();
+    w.key("uri");
+    w.string(uri.c_str(), uri.size());
+    w.key("type");
+    w.int64(int(FileChangeType::Changed));
+    w.endObject();
+  }
+  w.endArray();
+}
+
+struct SoakSample {
+  int64_t rss = 0, files = 0, symbols = 0, interned = 0, query_us = 0,
+          index_ms = 0;
+};
+} // namespace
+
+bool soak(const std::string &root, int minutes) {
+  Standalone st(root);
+  Project &project = st.project;
+  WorkingFiles &wfiles = st.wfiles;
+  SemaManager &manager = st.manager;
+  DB &db = st.db;
+  MessageHandler &handler = st.handler;
+
+  // Applies index updates as mainLoop does until no request is pending, and
+  // does the work mainLoop does when it becomes idle. Returns the time taken.
+  auto settle = [&]() {
+    auto start = chrono::steady_clock::now();
+    while (true) {
+      bool idle = !pending_index_requests;
+      for (IndexUpdate &update : on_indexed->dequeueAll())
+        main_OnIndexed(&db, &wfiles, &update);
+      (void)for_stdout->dequeueAll();
+      if (idle)
+        break;
+      std::this_thread::sleep_for(chrono::milliseconds(10));
+    }
+    int64_t ms = chrono::duration_cast<chrono::milliseconds>(
+                     chrono::steady_clock::now() - start)
+                     .count();
+    reclaimMemory(true);
+    // Reclaim regardless of memory.reclaimStrings, as each round interns new
+    // names.
+    collectStrings(db, project, manager, true);
+    return ms;
+  };
+  std::vector<int64_t> latencies;
+  auto run = [&](const char *method, bool request,
+                 const std::function<void(JsonWriter &)> &fn) {
+    InMessage msg = parseMessage(method, request, fn);
+    auto start = chrono::steady_clock::now();
+    try {
+      handler.run(msg);
+    } catch (NotIndexed &) {
+      return;
+    }
+    if (request)
+      latencies.push_back(chrono::duration_cast<chrono::microseconds>(
+                              chrono::steady_clock::now() - start)
+                              .count());
+  };
+
+  settle();
+  std::vector<std::string> files, uris;
+  {
+    std::lock_guard lock(project.mtx);
+    for (auto &[_, folder] : project.root2folder)
+      for (auto &entry : folder.entries)
+        files.push_back(entry.filename);
+  }
+  for (auto &path : files)
+    uris.push_back(DocumentUri::fromPath(path).raw_uri);
+  if (files.empty()) {
+    fprintf(stderr, "no files to edit in %s\n", root.c_str());
+    quit(manager);
+    return false;
+  }
+
+  // Each round edits a file with a uniquely named declaration, saves it,
+  // queries it, then closes and reverts it so that the index should return to
+  // its previous state. Every 10th round simulates a branch switch by changing
+  // all files, every 50th reloads the project.
+  std::mt19937 rng(0);
+  std::vector<SoakSample> samples;
+  auto deadline = chrono::steady_clock::now() + chrono::minutes(minutes);
+  printf("round,rss_mib,files,symbols,interned_kib,query_max_us,index_ms\n");
+  for (int round = 1; chrono::steady_clock::now() < deadline; round++) {
+    size_t i = rng() % files.size();
+    const std::string &uri = uris[i];
+    std::string content = readContent(files[i]).value_or("");
+    int line = std::count(content.begin(), content.end(), '\n') + 1;
+    latencies.clear();
+
+    run("textDocument/didOpen", false, [&](JsonWriter &w) {
+      w.startObject();
+      w.key("textDocument");
+      w.startObject();
+      w.key("uri");
+      w.string(uri.c_str(), uri.size());
+      w.key("languageId");
+      w.string("cpp");
+      w.key("version");
+      w.int64(0);
+      w.key("text");
+      w.string(content.c_str(), content.size());
+      w.endObject();
+      w.endObject();
+    });
+    for (int version = 1; version <= 3; version++) {
+      std::string text = content + "\nint ccls_soak_" +
+                         std::to_string(round) + "_" +
+                         std::to_string(version) + ";\n";
+      run("textDocument/didChange", false, [&](JsonWriter &w) {
+        w.startObject();
+        writeDocument(w, uri, version);
+        w.key("contentChanges");
+        w.startArray();
+        w.startObject();
+        w.key("text");
+        w.string(text.c_str(), text.size());
+        w.endObject();
+        w.endArray();
+        w.endObject();
+      });
+    }
+    run("textDocument/didSave", false, [&](JsonWriter &w) {
+      w.startObject();
+      writeDocument(w, uri);
+      w.endObject();
+    });
+    int64_t index_ms = settle();
+
+    run("textDocument/documentSymbol", true, [&](JsonWriter &w) {
+      w.startObject();
+      writeDocument(w, uri);
+      w.endObject();
+    });
+    run("textDocument/references", true, [&](JsonWriter &w) {
+      w.startObject();
+      writeDocument(w, uri);
+      w.key("position");
+      w.startObject();
+      w.key("line");
+      w.int64(line);
+      w.key("character");
+      w.int64(4);
+      w.endObject();
+      w.endObject();
+    });
+    run("workspace/symbol", true, [&](JsonWriter &w) {
+      w.startObject();
+      w.key("query");
+      w.string("ccls_soak");
+      w.endObject();
+    });
+
+    run("textDocument/didClose", false, [&](JsonWriter &w) {
+      w.startObject();
+      writeDocument(w, uri);
+      w.endObject();
+    });
+    run("workspace/didChangeWatchedFiles", false, [&](JsonWriter &w) {
+      w.startObject();
+      writeChanges(w, round % 10 ? std::vector<std::string>{uri} : uris);
+      w.endObject();
+    });
+    if (round % 50 == 0)
+      run("$ccls/reload", false, [](JsonWriter &w) {
+        w.startObject();
+        w.endObject();
+      });
+    index_ms += settle();
+
+    SoakSample sample;
+    sample.rss = getResidentMemory();
+    sample.files = db.files.size();
+    for (auto &func : db.funcs)
+      sample.symbols += !func.def.empty();
+    for (auto &type : db.types)
+      sample.symbols += !type.def.empty();
+    for (auto &var : db.vars)
+      sample.symbols += !var.def.empty();
+    sample.interned = internedSize().second;
+    for (int64_t us : latencies)
+      sample.query_us = std::max(sample.query_us, us);
+    sample.index_ms = index_ms;
+    samples.push_back(sample);
+    printf("%d,%" PRId64 ",%" PRId64 ",%" PRId64 ",%" PRId64 ",%" PRId64
+           ",%" PRId64 "\n",
+           round, sample.rss >> 20, sample.files, sample.symbols,
+           sample.interned >> 10, sample.query_us, sample.index_ms);
+    fflush(stdout);
+  }
+  quit(manager);
+
+  // Compare the lowest value of each metric over the first and the last tenth
+  // of the rounds. Latency is noisy and only flagged if it doubles.
+  struct Metric {
+    const char *name;
+    int64_t SoakSample::*field;
+    int percent;
+  } metrics[] = {{"rss", &SoakSample::rss, 10},
+                 {"files", &SoakSample::files, 0},
+                 {"symbols", &SoakSample::symbols, 1},
+                 {"interned", &SoakSample::interned, 10},
+                 {"query_max_us", &SoakSample::query_us, 100}};
+  size_t n = std::max<size_t>(samples.size() / 10, 1);
+  bool ok = true;
+  for (auto &m : metrics) {
+    if (samples.size() < 2)
+      break;
+    int64_t first = INT64_MAX, last = INT64_MAX;
+    for (size_t i = 0; i < n; i++) {
+      first = std::min(first, samples[i].*m.field);
+      last = std::min(last, samples[samples.size() - 1 - i].*m.field);
+    }
+    if (last > first + first * m.percent / 100) {
+      printf("%s grew from %" PRId64 " to %" PRId64 "\n", m.name, first,
+             last);
+      ok = false;
+    }
+  }
+  printf("%zu rounds, %s\n", samples.size(), ok ? "no drift" : "drift");
+  return ok;
+}
 } // namespace pipeline
 } // namespace ccls
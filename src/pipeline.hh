@@ -8,6 +8,7 @@
 
 #include <atomic>
 #include <mutex>
+#include <shared_mutex>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -20,16 +21,39 @@ struct WorkingFiles;
 
 struct VFS {
   struct State {
-    int64_t timestamp;
-    int step;
-    int loaded;
+    int64_t timestamp = 0;
+    int step = 0;
+    int loaded = 0;
   };
-  std::unordered_map<std::string, State> state;
-  std::mutex mutex;
+  // Sharded by path hash since all indexers access it for every file. Each
+  // shard has its own cache line.
+  struct alignas(64) Shard {
+    std::unordered_map<std::string, State> state;
+    std::shared_mutex mutex;
+    // Number of lock acquisitions and of those that had to wait.
+    std::atomic<int64_t> locks{0}, contended{0};
+  };
+  static constexpr int kShards = 64;
+  Shard shards[kShards];
 
   void clear();
+  State get(const std::string &path);
   int loaded(const std::string &path);
   bool stamp(const std::string &path, int64_t ts, int step);
+  // Stamps files, locking each shard once. Returns those that were stamped.
+  std::vector<std::string> stamp(const decltype(IndexFile::dependencies) &deps,
+                                 int step);
+  // Calls |fn| with the state of |path| under the lock of its shard.
+  template <typename Fn> auto update(const std::string &path, Fn &&fn) {
+    Shard &sh = shard(path);
+    std::unique_lock lock = lockShard(sh);
+    return fn(sh.state[path]);
+  }
+
+private:
+  Shard &shard(const std::string &path);
+  std::unique_lock<std::shared_mutex> lockShard(Shard &sh);
+  static bool stampUnlocked(State &st, int64_t ts, int step);
 };
 
 enum class IndexMode {
@@ -42,6 +66,15 @@ enum class IndexMode {
 namespace pipeline {
 extern std::atomic<bool> g_quit;
 extern std::atomic<int64_t> loaded_ts, pending_index_requests;
+extern std::atomic<int64_t> peak_rss, trim_count;
+extern std::atomic<int64_t> dependent_batches, dependent_ms;
+extern std::atomic<int64_t> first_query_ms, main_first_query_ms;
+extern std::atomic<int64_t> cache_loaded, cache_load_ms;
+extern std::atomic<int64_t> apply_count, apply_us, apply_max_us;
+extern std::atomic<int64_t> notify_skipped, notify_skipped_bytes,
+    notify_skipped_us;
+extern std::atomic<int64_t> indexer_limit, indexer_pauses, indexer_paused_ms;
+extern std::atomic<int64_t> reclaimed_strings, reclaimed_bytes;
 extern int64_t tick;
 
 void threadEnter();
@@ -50,12 +83,25 @@ void init();
 void launchStdin();
 void launchStdout();
 void indexer_Main(SemaManager *manager, VFS *vfs, Project *project,
-                  WorkingFiles *wfiles);
+                  WorkingFiles *wfiles, int idx);
+// Records a textDocument/didChange for the indexer governor.
+void markEdited();
 void mainLoop();
 void standalone(const std::string &root);
+// Indexes |root| like standalone, then simulates edits, saves, watched file
+// changes, reloads and queries for |minutes|. Prints a sample per round and
+// returns false if memory, index size or query latency did not return to
+// their initial level.
+bool soak(const std::string &root, int minutes);
 
 void index(const std::string &path, const std::vector<const char *> &args,
            IndexMode mode, bool must_exist, RequestId id = {});
+// Reindexes the open translation units that transitively include |path| and
+// marks the others stale.
+void indexDependents(DB *db, Project *project, WorkingFiles *wfiles,
+                     const std::string &path);
+// Reindexes |path| if it was marked stale by indexDependents.
+void indexIfStale(const std::string &path);
 void removeCache(const std::string &path);
 std::optional<std::string> loadIndexedContent(const std::string &path);
 
@@ -67,6 +113,16 @@ template <typename T> void notify(const char *method, T &result) {
 template <typename T> void request(const char *method, T &result) {
   notifyOrRequest(method, true, [&](JsonWriter &w) { reflect(w, result); });
 }
+// Sends a notification about |path| unless it is identical to the last one of
+// |method| for |path|.
+void notifyIfChanged(const char *method, const std::string &path,
+                     const std::function<void(JsonWriter &)> &fn);
+template <typename T>
+void notifyIfChanged(const char *method, const std::string &path, T &result) {
+  notifyIfChanged(method, path, [&](JsonWriter &w) { reflect(w, result); });
+}
+// Forgets notifications sent for |path|, e.g. when it is closed.
+void forgetNotified(const std::string &path);
 
 void reply(const RequestId &id, const std::function<void(JsonWriter &)> &fn);
 
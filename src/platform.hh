@@ -3,6 +3,7 @@
 
 #pragma once
 
+#include <stdint.h>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -13,8 +14,18 @@ std::string normalizePath(const std::string &path);
 // Free any unused memory and return it to the system.
 void freeUnusedMemory();
 
+// Limit the number of malloc arenas. 0 keeps the allocator default.
+void setMallocArenaMax(int n);
+
+// Return the current resident set size in bytes, or 0 if it cannot be
+// determined.
+int64_t getResidentMemory();
+
 // Stop self and wait for SIGCONT.
 void traceMe();
 
 void spawnThread(void *(*fn)(void *), void *arg);
+
+// Lower the scheduling priority of the calling thread to the background level.
+void lowerThreadPriority();
 } // namespace ccls
@@ -20,12 +20,21 @@
 #include <signal.h>
 #include <sys/resource.h>
 #include <sys/stat.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 #include <sys/types.h> // required for stat.h
 #include <sys/wait.h>
 #include <unistd.h>
 #ifdef __GLIBC__
 #include <malloc.h>
 #endif
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
+#ifdef CCLS_USE_MIMALLOC
+#include <mimalloc.h>
+#endif
 
 #include <llvm/ADT/SmallString.h>
 #include <llvm/Support/Path.h>
@@ -47,11 +56,45 @@ std::string normalizePath(const std::string &path) {
 }
 
 void freeUnusedMemory() {
-#ifdef __GLIBC__
+#if defined(CCLS_USE_MIMALLOC)
+  mi_collect(true);
+#elif defined(__GLIBC__)
   malloc_trim(4 * 1024 * 1024);
 #endif
 }
 
+void setMallocArenaMax(int n) {
+#if defined(__GLIBC__) && !defined(CCLS_USE_MIMALLOC)
+  if (n > 0)
+    mallopt(M_ARENA_MAX, n);
+#endif
+}
+
+int64_t getResidentMemory() {
+#ifdef __linux__
+  FILE *fp = fopen("/proc/self/statm", "r");
+  if (!fp)
+    return 0;
+  long size, resident;
+  int n = fscanf(fp, "%ld %ld", &size, &resident);
+  fclose(fp);
+  if (n != 2)
+    return 0;
+  return int64_t(resident) * sysconf(_SC_PAGESIZE);
+#elif defined(__APPLE__)
+  mach_task_basic_info_data_t info;
+  mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+  if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info,
+                &count) != KERN_SUCCESS)
+    return 0;
+  return info.resident_size;
+#else
+  // getrusage only reports the peak, which would keep RSS-driven policies on
+  // once the limit has been crossed.
+  return 0;
+#endif
+}
+
 void traceMe() {
   // If the environment variable is defined, wait for a debugger.
   // In gdb, you need to invoke `signal SIGCONT` if you want ccls to continue
@@ -75,6 +118,15 @@ void spawnThread(void *(*fn)(void *), void *arg) {
   pthread_create(&thd, &attr, fn, arg);
   pthread_attr_destroy(&attr);
 }
+
+void lowerThreadPriority() {
+#if defined(__linux__)
+  // Nice values are per thread on Linux.
+  setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+#elif defined(__APPLE__)
+  setpriority(PRIO_DARWIN_THREAD, 0, PRIO_DARWIN_BG);
+#endif
+}
 } // namespace ccls
 
 #endif
@@ -7,6 +7,7 @@
 #include "utils.hh"
 
 #include <Windows.h>
+#include <psapi.h>
 #include <direct.h>
 #include <fcntl.h>
 #include <io.h>
@@ -42,12 +43,25 @@ std::string normalizePath(const std::string &path) {
 
 void freeUnusedMemory() {}
 
+void setMallocArenaMax(int) {}
+
+int64_t getResidentMemory() {
+  PROCESS_MEMORY_COUNTERS pmc;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof pmc))
+    return 0;
+  return pmc.WorkingSetSize;
+}
+
 // TODO Wait for debugger to attach
 void traceMe() {}
 
 void spawnThread(void *(*fn)(void *), void *arg) {
   std::thread(fn, arg).detach();
 }
+
+void lowerThreadPriority() {
+  SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_IDLE);
+}
 } // namespace ccls
 
 #endif
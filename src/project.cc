@@ -59,6 +59,9 @@ std::pair<LanguageId, bool> lookupExtension(std::string_view filename) {
   return {ret, header};
 }
 
+REFLECT_STRUCT(DirectorySnapshot::Dir, path, mtime, listed, files, dirs,
+               links);
+
 namespace {
 
 enum OptionClass {
@@ -245,6 +248,8 @@ std::vector<const char *> getFallback(const std::string &path) {
   return argv;
 }
 
+constexpr int kSnapshotVersion = 2;
+
 void loadDirectoryListing(ProjectProcessor &proc, const std::string &root,
                           const StringSet<> &seen) {
   Project::Folder &folder = proc.folder;
@@ -264,6 +269,28 @@ void loadDirectoryListing(ProjectProcessor &proc, const std::string &root,
     return folder.dot_ccls[root];
   };
 
+  // Directories whose modification times are unchanged since the last load are
+  // not read again.
+  DirectorySnapshot snapshot;
+  std::string snapshot_path;
+  if (g_config->cache.directory.size()) {
+    snapshot_path = g_config->cache.directory +
+                    escapeFileName(root.substr(0, root.size() - 1)) + ".dirs";
+    if (std::optional<std::string> content = readContent(snapshot_path))
+      try {
+        int version;
+        if (content->size() < 4)
+          throw std::invalid_argument("Invalid");
+        BinaryReader reader(*content);
+        reflect(reader, version);
+        if (version != kSnapshotVersion)
+          throw std::invalid_argument("Invalid version");
+        reflect(reader, snapshot.dirs);
+      } catch (std::invalid_argument &e) {
+        snapshot.dirs.clear();
+      }
+  }
+
   getFilesInFolder(root, true /*recursive*/, true /*add_folder_to_path*/,
                    [&folder, &files, &seen](const std::string &path) {
                      std::pair<LanguageId, bool> lang = lookupExtension(path);
@@ -283,7 +310,15 @@ void loadDirectoryListing(ProjectProcessor &proc, const std::string &root,
                        }
                        LOG_S(INFO) << "use " << path << ": " << l;
                      }
-                   });
+                   },
+                   &snapshot);
+  if (snapshot_path.size()) {
+    BinaryWriter writer;
+    int version = kSnapshotVersion;
+    reflect(writer, version);
+    reflect(writer, snapshot.dirs);
+    writeToFile(snapshot_path, writer.take());
+  }
 
   // If the first line of .ccls is %compile_commands.json, append extra flags.
   for (auto &e : folder.entries)
@@ -633,6 +668,18 @@ void Project::index(WorkingFiles *wfiles, const RequestId &id) {
   pipeline::index("", {}, IndexMode::Background, false);
 }
 
+bool Project::isTranslationUnit(const std::string &path) {
+  std::lock_guard lock(mtx);
+  for (auto &[root, folder] : root2folder) {
+    // path2entry_index also maps dependencies to the entry that loaded them.
+    auto it = folder.path2entry_index.find(path);
+    if (it != folder.path2entry_index.end() &&
+        folder.entries[it->second].filename == path)
+      return true;
+  }
+  return false;
+}
+
 void Project::indexRelated(const std::string &path) {
   auto &gi = g_config->index;
   GroupMatch match(gi.whitelist, gi.blacklist);
@@ -655,4 +702,25 @@ void Project::indexRelated(const std::string &path) {
       break;
     }
 }
+
+std::vector<std::string> Project::relatedFiles(const std::string &path) {
+  std::vector<std::string> ret;
+  std::string stem = sys::path::stem(path);
+  if (!lookupExtension(path).second) {
+    SmallString<256> header(path);
+    for (const char *ext : {".h", ".hh", ".hpp", ".hxx"}) {
+      sys::path::replace_extension(header, ext);
+      ret.push_back(header.str().str());
+    }
+  }
+  std::lock_guard lock(mtx);
+  for (auto &[root, folder] : root2folder)
+    if (StringRef(path).startswith(root)) {
+      for (const Project::Entry &entry : folder.entries)
+        if (sys::path::stem(entry.filename) == stem && entry.filename != path)
+          ret.push_back(entry.filename);
+      break;
+    }
+  return ret;
+}
 } // namespace ccls
@@ -65,6 +65,11 @@ struct Project {
                       const std::string &path);
 
   void index(WorkingFiles *wfiles, const RequestId &id);
+  // Whether |path| has an entry of its own, e.g. in compile_commands.json.
+  bool isTranslationUnit(const std::string &path);
   void indexRelated(const std::string &path);
+  // Returns the translation units with the same stem as |path| and, for a
+  // source file, headers with its stem next to it, which may not exist.
+  std::vector<std::string> relatedFiles(const std::string &path);
 };
 } // namespace ccls
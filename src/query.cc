@@ -15,6 +15,7 @@
 #include <optional>
 #include <stdint.h>
 #include <string>
+#include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -67,6 +68,30 @@ bool tryReplaceDef(llvm::SmallVectorImpl<Q> &def_list, Q &&def) {
   return false;
 }
 
+// A symbol is in short_name2sym under the name of its first def.
+template <typename Def>
+std::optional<std::string_view>
+shortName(const llvm::SmallVectorImpl<Def> &defs) {
+  if (defs.empty())
+    return {};
+  if constexpr (std::is_same_v<Def, QueryVar::Def>)
+    if (defs[0].is_local())
+      return {};
+  return defs[0].name(false);
+}
+
+// Re-keys |sym| after its first def may have changed from |old| to |now|.
+void replaceShortName(DB &db, SymbolIdx sym,
+                      std::optional<std::string_view> old,
+                      std::optional<std::string_view> now) {
+  if (old == now)
+    return;
+  if (old)
+    db.removeShortName(sym, *old);
+  if (now)
+    db.addShortName(sym, *now);
+}
+
 } // namespace
 
 template <typename T> Vec<T> convert(const std::vector<T> &o) {
@@ -190,6 +215,69 @@ void DB::clear() {
   funcs.clear();
   types.clear();
   vars.clear();
+  short_name2sym.clear();
+  includers.clear();
+  shared_refs = 0;
+}
+
+void DB::addShortName(SymbolIdx sym, std::string_view name) {
+  short_name2sym.emplace(hashUsr({name.data(), name.size()}), sym);
+}
+
+std::vector<int>
+DB::dependentRoots(const std::string &path,
+                   const std::function<bool(const std::string &)> &is_tu) {
+  std::vector<int> ret;
+  std::unordered_set<int> seen;
+  std::vector<std::string> todo{path};
+  while (todo.size()) {
+    auto it = includers.find(todo.back());
+    todo.pop_back();
+    if (it == includers.end())
+      continue;
+    for (auto [file_id, line] : it->second) {
+      auto &def = files[file_id].def;
+      if (!def || !seen.insert(file_id).second)
+        continue;
+      bool included = includers.count(def->path);
+      if (!included || is_tu(def->path))
+        ret.push_back(file_id);
+      if (included)
+        todo.push_back(def->path);
+    }
+  }
+  return ret;
+}
+
+void DB::addIncluders(int file_id) {
+  if (auto &def = files[file_id].def)
+    for (const IndexInclude &include : def->includes)
+      includers[include.resolved_path].emplace_back(file_id, include.line);
+}
+
+void DB::removeIncluders(int file_id) {
+  if (auto &def = files[file_id].def)
+    for (const IndexInclude &include : def->includes) {
+      auto it = includers.find(include.resolved_path);
+      if (it == includers.end())
+        continue;
+      auto &v = it->second;
+      v.erase(std::remove_if(v.begin(), v.end(),
+                             [=](auto &x) { return x.first == file_id; }),
+              v.end());
+      if (v.empty())
+        includers.erase(it);
+    }
+}
+
+void DB::removeShortName(SymbolIdx sym, std::string_view name) {
+  auto [it, end] =
+      short_name2sym.equal_range(hashUsr({name.data(), name.size()}));
+  for (; it != end; ++it)
+    if (it->second == sym) {
+      short_name2sym.erase(it);
+      break;
+    }
 }
 
 template <typename Def>
@@ -205,8 +293,11 @@ void DB::removeUsrs(Kind kind, int file_id,
       auto it = llvm::find_if(func.def, [=](const QueryFunc::Def &def) {
         return def.file_id == file_id;
       });
-      if (it != func.def.end())
+      if (it != func.def.end()) {
+        std::optional<std::string_view> old = shortName(func.def);
         func.def.erase(it);
+        replaceShortName(*this, {usr, Kind::Func}, old, shortName(func.def));
+      }
     }
     break;
   }
@@ -219,8 +310,11 @@ void DB::removeUsrs(Kind kind, int file_id,
       auto it = llvm::find_if(type.def, [=](const QueryType::Def &def) {
         return def.file_id == file_id;
       });
-      if (it != type.def.end())
+      if (it != type.def.end()) {
+        std::optional<std::string_view> old = shortName(type.def);
         type.def.erase(it);
+        replaceShortName(*this, {usr, Kind::Type}, old, shortName(type.def));
+      }
     }
     break;
   }
@@ -233,8 +327,11 @@ void DB::removeUsrs(Kind kind, int file_id,
       auto it = llvm::find_if(var.def, [=](const QueryVar::Def &def) {
         return def.file_id == file_id;
       });
-      if (it != var.def.end())
+      if (it != var.def.end()) {
+        std::optional<std::string_view> old = shortName(var.def);
         var.def.erase(it);
+        replaceShortName(*this, {usr, Kind::Var}, old, shortName(var.def));
+      }
     }
     break;
   }
@@ -275,10 +372,11 @@ void DB::applyIndexUpdate(IndexUpdate *u) {
         use.file_id == -1 ? u->file_id : lid2fid.find(use.file_id)->second;
     ExtentRef sym{{use.range, usr, kind, use.role}};
     int &v = files[use.file_id].symbol2refcnt[sym];
-    v += delta;
+    int ret = v += delta;
     assert(v >= 0);
     if (!v)
       files[use.file_id].symbol2refcnt.erase(sym);
+    return ret;
   };
   auto refDecl = [&](std::unordered_map<int, int> &lid2fid, Usr usr, Kind kind,
                      DeclRef &dr, int delta) {
@@ -286,10 +384,31 @@ void DB::applyIndexUpdate(IndexUpdate *u) {
         dr.file_id == -1 ? u->file_id : lid2fid.find(dr.file_id)->second;
     ExtentRef sym{{dr.range, usr, kind, dr.role}, dr.extent};
     int &v = files[dr.file_id].symbol2refcnt[sym];
-    v += delta;
+    int ret = v += delta;
     assert(v >= 0);
     if (!v)
       files[dr.file_id].symbol2refcnt.erase(sym);
+    return ret;
+  };
+  // With index.multiVersion, each translation unit including a header emits
+  // the header's references. Identical ones are stored once and reference
+  // counted by symbol2refcnt, so drop removals and additions that only change
+  // the count.
+  auto updateDecls = [&](Usr usr, Kind kind, auto &del_add) {
+    size_t n = 0;
+    for (DeclRef &dr : del_add.first)
+      if (!refDecl(prev_lid2file_id, usr, kind, dr, -1))
+        del_add.first[n++] = dr;
+      else
+        shared_refs--;
+    del_add.first.resize(n);
+    n = 0;
+    for (DeclRef &dr : del_add.second)
+      if (refDecl(lid2file_id, usr, kind, dr, 1) == 1)
+        del_add.second[n++] = dr;
+      else
+        shared_refs++;
+    del_add.second.resize(n);
   };
 
   auto updateUses =
@@ -302,6 +421,7 @@ void DB::applyIndexUpdate(IndexUpdate *u) {
           entities.back().usr = usr;
         }
         auto &entity = entities[r.first->second];
+        std::vector<Use> removed, added;
         for (Use &use : p.first) {
           if (hint_implicit && use.role & Role::Implicit) {
             // Make ranges of implicit function calls larger (spanning one more
@@ -312,88 +432,69 @@ void DB::applyIndexUpdate(IndexUpdate *u) {
               use.range.start.column--;
             use.range.end.column++;
           }
-          ref(prev_lid2file_id, usr, kind, use, -1);
+          if (!ref(prev_lid2file_id, usr, kind, use, -1))
+            removed.push_back(use);
+          else
+            shared_refs--;
         }
-        removeRange(entity.uses, p.first);
+        removeRange(entity.uses, removed);
         for (Use &use : p.second) {
           if (hint_implicit && use.role & Role::Implicit) {
             if (use.range.start.column > 0)
               use.range.start.column--;
             use.range.end.column++;
           }
-          ref(lid2file_id, usr, kind, use, 1);
+          if (ref(lid2file_id, usr, kind, use, 1) == 1)
+            added.push_back(use);
+          else
+            shared_refs++;
         }
-        addRange(entity.uses, p.second);
+        addRange(entity.uses, added);
       };
 
-  if (u->files_removed)
-    files[name2file_id[lowerPathIfInsensitive(*u->files_removed)]].def =
-        std::nullopt;
+  if (u->files_removed) {
+    int file_id = name2file_id[lowerPathIfInsensitive(*u->files_removed)];
+    removeIncluders(file_id);
+    files[file_id].def = std::nullopt;
+  }
   u->file_id =
       u->files_def_update ? update(std::move(*u->files_def_update)) : -1;
 
-  const double grow = 1.3;
-  size_t t;
-
-  if ((t = funcs.size() + u->funcs_hint) > funcs.capacity()) {
-    t = size_t(t * grow);
-    funcs.reserve(t);
-    func_usr.reserve(t);
-  }
+  func_usr.reserve(funcs.size() + u->funcs_hint);
   for (auto &[usr, def] : u->funcs_removed)
     if (def.spell)
       refDecl(prev_lid2file_id, usr, Kind::Func, *def.spell, -1);
   removeUsrs(Kind::Func, u->file_id, u->funcs_removed);
   update(lid2file_id, u->file_id, std::move(u->funcs_def_update));
-  for (auto &[usr, del_add] : u->funcs_declarations) {
-    for (DeclRef &dr : del_add.first)
-      refDecl(prev_lid2file_id, usr, Kind::Func, dr, -1);
-    for (DeclRef &dr : del_add.second)
-      refDecl(lid2file_id, usr, Kind::Func, dr, 1);
-  }
+  for (auto &[usr, del_add] : u->funcs_declarations)
+    updateDecls(usr, Kind::Func, del_add);
   REMOVE_ADD(func, declarations);
   REMOVE_ADD(func, derived);
   for (auto &[usr, p] : u->funcs_uses)
     updateUses(usr, Kind::Func, func_usr, funcs, p, true);
 
-  if ((t = types.size() + u->types_hint) > types.capacity()) {
-    t = size_t(t * grow);
-    types.reserve(t);
-    type_usr.reserve(t);
-  }
+  type_usr.reserve(types.size() + u->types_hint);
   for (auto &[usr, def] : u->types_removed)
     if (def.spell)
       refDecl(prev_lid2file_id, usr, Kind::Type, *def.spell, -1);
   removeUsrs(Kind::Type, u->file_id, u->types_removed);
   update(lid2file_id, u->file_id, std::move(u->types_def_update));
-  for (auto &[usr, del_add] : u->types_declarations) {
-    for (DeclRef &dr : del_add.first)
-      refDecl(prev_lid2file_id, usr, Kind::Type, dr, -1);
-    for (DeclRef &dr : del_add.second)
-      refDecl(lid2file_id, usr, Kind::Type, dr, 1);
-  }
+  for (auto &[usr, del_add] : u->types_declarations)
+    updateDecls(usr, Kind::Type, del_add);
   REMOVE_ADD(type, declarations);
   REMOVE_ADD(type, derived);
   REMOVE_ADD(type, instances);
   for (auto &[usr, p] : u->types_uses)
     updateUses(usr, Kind::Type, type_usr, types, p, false);
 
-  if ((t = vars.size() + u->vars_hint) > vars.capacity()) {
-    t = size_t(t * grow);
-    vars.reserve(t);
-    var_usr.reserve(t);
-  }
+  var_usr.reserve(vars.size() + u->vars_hint);
   for (auto &[usr, def] : u->vars_removed)
     if (def.spell)
       refDecl(prev_lid2file_id, usr, Kind::Var, *def.spell, -1);
   removeUsrs(Kind::Var, u->file_id, u->vars_removed);
   update(lid2file_id, u->file_id, std::move(u->vars_def_update));
-  for (auto &[usr, del_add] : u->vars_declarations) {
-    for (DeclRef &dr : del_add.first)
-      refDecl(prev_lid2file_id, usr, Kind::Var, dr, -1);
-    for (DeclRef &dr : del_add.second)
-      refDecl(lid2file_id, usr, Kind::Var, dr, 1);
-  }
+  for (auto &[usr, del_add] : u->vars_declarations)
+    updateDecls(usr, Kind::Var, del_add);
   REMOVE_ADD(var, declarations);
   for (auto &[usr, p] : u->vars_uses)
     updateUses(usr, Kind::Var, var_usr, vars, p, false);
@@ -412,7 +513,9 @@ int DB::getFileId(const std::string &path) {
 
 int DB::update(QueryFile::DefUpdate &&u) {
   int file_id = getFileId(u.first.path);
+  removeIncluders(file_id);
   files[file_id].def = u.first;
+  addIncluders(file_id);
   return file_id;
 }
 
@@ -434,8 +537,11 @@ void DB::update(const Lid2file_id &lid2file_id, int file_id,
       funcs.emplace_back();
     QueryFunc &existing = funcs[r.first->second];
     existing.usr = u.first;
+    std::optional<std::string_view> old = shortName(existing.def);
     if (!tryReplaceDef(existing.def, std::move(def)))
       existing.def.push_back(std::move(def));
+    replaceShortName(*this, {u.first, Kind::Func}, old,
+                     shortName(existing.def));
   }
 }
 
@@ -456,8 +562,11 @@ void DB::update(const Lid2file_id &lid2file_id, int file_id,
       types.emplace_back();
     QueryType &existing = types[r.first->second];
     existing.usr = u.first;
+    std::optional<std::string_view> old = shortName(existing.def);
     if (!tryReplaceDef(existing.def, std::move(def)))
       existing.def.push_back(std::move(def));
+    replaceShortName(*this, {u.first, Kind::Type}, old,
+                     shortName(existing.def));
   }
 }
 
@@ -478,8 +587,11 @@ void DB::update(const Lid2file_id &lid2file_id, int file_id,
       vars.emplace_back();
     QueryVar &existing = vars[r.first->second];
     existing.usr = u.first;
+    std::optional<std::string_view> old = shortName(existing.def);
     if (!tryReplaceDef(existing.def, std::move(def)))
       existing.def.push_back(std::move(def));
+    replaceShortName(*this, {u.first, Kind::Var}, old,
+                     shortName(existing.def));
   }
 }
 
@@ -537,7 +649,7 @@ int computeRangeSize(const Range &range) {
 template <typename Q, typename C>
 std::vector<Use>
 getDeclarations(llvm::DenseMap<Usr, int, DenseMapInfoForUsr> &entity_usr,
-                llvm::SmallVectorImpl<Q> &entities, const C &usrs) {
+                ChunkedVector<Q> &entities, const C &usrs) {
   std::vector<Use> ret;
   ret.reserve(usrs.size());
   for (Usr usr : usrs) {
@@ -11,6 +11,10 @@
 #include <llvm/ADT/SmallVector.h>
 #include <llvm/ADT/StringMap.h>
 
+#include <functional>
+#include <memory>
+#include <unordered_map>
+
 namespace llvm {
 template <> struct DenseMapInfo<ccls::ExtentRef> {
   static inline ccls::ExtentRef getEmptyKey() { return {}; }
@@ -141,17 +145,81 @@ struct DenseMapInfoForUsr {
 
 using Lid2file_id = std::unordered_map<int, int>;
 
+// A sequence with O(1) indexing whose elements are allocated in fixed-size
+// chunks, so that growing it never relocates existing elements.
+template <typename T, size_t ChunkSize = 1024> class ChunkedVector {
+  std::vector<std::unique_ptr<T[]>> chunks;
+  size_t n = 0;
+
+public:
+  template <typename C, typename E> struct Iterator {
+    C *c;
+    size_t i;
+    E &operator*() const { return (*c)[i]; }
+    E *operator->() const { return &(*c)[i]; }
+    Iterator &operator++() {
+      i++;
+      return *this;
+    }
+    bool operator!=(const Iterator &o) const { return i != o.i; }
+    bool operator==(const Iterator &o) const { return i == o.i; }
+  };
+  using iterator = Iterator<ChunkedVector, T>;
+  using const_iterator = Iterator<const ChunkedVector, const T>;
+
+  size_t size() const { return n; }
+  bool empty() const { return !n; }
+  T &operator[](size_t i) { return chunks[i / ChunkSize][i % ChunkSize]; }
+  const T &operator[](size_t i) const {
+    return chunks[i / ChunkSize][i % ChunkSize];
+  }
+  T &back() { return (*this)[n - 1]; }
+  // Elements are default constructed when their chunk is allocated.
+  T &emplace_back() {
+    if (n == chunks.size() * ChunkSize)
+      chunks.push_back(std::make_unique<T[]>(ChunkSize));
+    return (*this)[n++];
+  }
+  void clear() {
+    chunks.clear();
+    n = 0;
+  }
+  iterator begin() { return {this, 0}; }
+  iterator end() { return {this, n}; }
+  const_iterator begin() const { return {this, 0}; }
+  const_iterator end() const { return {this, n}; }
+};
+
 // The query database is heavily optimized for fast queries. It is stored
 // in-memory.
 struct DB {
   std::vector<QueryFile> files;
   llvm::StringMap<int> name2file_id;
   llvm::DenseMap<Usr, int, DenseMapInfoForUsr> func_usr, type_usr, var_usr;
-  llvm::SmallVector<QueryFunc, 0> funcs;
-  llvm::SmallVector<QueryType, 0> types;
-  llvm::SmallVector<QueryVar, 0> vars;
+  ChunkedVector<QueryFunc> funcs;
+  ChunkedVector<QueryType> types;
+  ChunkedVector<QueryVar> vars;
+  // Entities with definitions (excluding local variables), keyed by the hash
+  // of the short name.
+  std::unordered_multimap<uint64_t, SymbolIdx> short_name2sym;
+  // Reverse include graph: resolved path => (file_id, line) of the #include
+  // lines that include it. Entries of a file are contiguous.
+  llvm::StringMap<std::vector<std::pair<int, int>>> includers;
+  // Number of references not stored because an identical one from another
+  // version of a multiVersion header is.
+  int64_t shared_refs = 0;
 
   void clear();
+  void addShortName(SymbolIdx sym, std::string_view name);
+  void removeShortName(SymbolIdx sym, std::string_view name);
+  // The translation units that transitively include |path|: files for which
+  // |is_tu| holds (even if included, as in unity builds) and files not
+  // included by others.
+  std::vector<int>
+  dependentRoots(const std::string &path,
+                 const std::function<bool(const std::string &)> &is_tu);
+  void addIncluders(int file_id);
+  void removeIncluders(int file_id);
 
   template <typename Def>
   void removeUsrs(Kind kind, int file_id,
@@ -8,13 +8,17 @@
 #include "log.hh"
 #include "pipeline.hh"
 #include "platform.hh"
+#include "utils.hh"
 
+#include <clang/Lex/Lexer.h>
 #include <clang/Lex/PreprocessorOptions.h>
 #include <clang/Sema/CodeCompleteConsumer.h>
 #include <clang/Sema/Sema.h>
+#include <llvm/ADT/Hashing.h>
 #include <llvm/ADT/Twine.h>
 #include <llvm/Config/llvm-config.h>
 #include <llvm/Support/CrashRecoveryContext.h>
+#include <llvm/Support/FileSystem.h>
 #include <llvm/Support/Threading.h>
 using namespace clang;
 using namespace llvm;
@@ -324,8 +328,76 @@ buildCompilerInstance(Session &session, std::unique_ptr<CompilerInvocation> ci,
   return clang;
 }
 
-bool parse(CompilerInstance &clang) {
-  SyntaxOnlyAction action;
+// With SkipFunctionBodies, Sema asks the consumer whether each function body
+// may be skipped. Only parse main file bodies overlapping |regions| and record
+// the line ranges of the skipped ones.
+class RegionConsumer : public ASTConsumer {
+  const std::vector<std::pair<int, int>> &regions;
+  std::vector<std::pair<int, int>> &skipped;
+  ASTContext *ctx = nullptr;
+
+public:
+  RegionConsumer(const std::vector<std::pair<int, int>> &regions,
+                 std::vector<std::pair<int, int>> &skipped)
+      : regions(regions), skipped(skipped) {}
+  void Initialize(ASTContext &ctx) override { this->ctx = &ctx; }
+  bool shouldSkipFunctionBody(Decl *d) override {
+    const SourceManager &sm = ctx->getSourceManager();
+    SourceLocation begin = sm.getExpansionLoc(d->getBeginLoc()),
+                   end = sm.getExpansionLoc(d->getEndLoc());
+    if (!sm.isWrittenInMainFile(end))
+      return false;
+    // The body has not been parsed yet. Find its end by matching braces,
+    // continuing past constructor initializers like "a{1}," and handlers of
+    // a function-try-block.
+    auto [fid, off] = sm.getDecomposedLoc(end);
+    StringRef buf = sm.getBufferData(fid);
+    Lexer lex(sm.getLocForStartOfFile(fid), ctx->getLangOpts(), buf.begin(),
+              buf.begin() + off, buf.end());
+    Token tok;
+    unsigned end_off = buf.size();
+    int depth = 0;
+    bool closed = false;
+    while (!lex.LexFromRawLexer(tok)) {
+      if (closed) {
+        if (!(tok.isOneOf(tok::comma, tok::l_brace) ||
+              (tok.is(tok::raw_identifier) &&
+               tok.getRawIdentifier() == "catch")))
+          break;
+        closed = false;
+      }
+      if (tok.is(tok::l_brace))
+        depth++;
+      else if (tok.is(tok::r_brace) && depth > 0 && --depth == 0) {
+        end_off = sm.getFileOffset(tok.getLocation());
+        closed = true;
+      }
+    }
+    int b = sm.getExpansionLineNumber(begin) - 1,
+        e = sm.getLineNumber(fid, end_off) - 1;
+    for (auto &r : regions)
+      if (r.first <= e && b <= r.second)
+        return false;
+    skipped.emplace_back(b, e);
+    return true;
+  }
+};
+
+class RegionAction : public ASTFrontendAction {
+  const std::vector<std::pair<int, int>> &regions;
+  std::vector<std::pair<int, int>> &skipped;
+
+public:
+  RegionAction(const std::vector<std::pair<int, int>> &regions,
+               std::vector<std::pair<int, int>> &skipped)
+      : regions(regions), skipped(skipped) {}
+  std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &,
+                                                 StringRef) override {
+    return std::make_unique<RegionConsumer>(regions, skipped);
+  }
+};
+
+bool parse(CompilerInstance &clang, FrontendAction &action) {
   if (!action.BeginSourceFile(clang, clang.getFrontendOpts().Inputs[0]))
     return false;
 #if LLVM_VERSION_MAJOR >= 9 // rL364464
@@ -341,18 +413,44 @@ bool parse(CompilerInstance &clang) {
   return true;
 }
 
-void buildPreamble(Session &session, CompilerInvocation &ci,
+bool parse(CompilerInstance &clang) {
+  SyntaxOnlyAction action;
+  return parse(clang, action);
+}
+
+bool memoryShort() {
+  int64_t limit = int64_t(g_config->memory.rssLimit) << 20;
+  return limit && getResidentMemory() >= limit / 10 * 9;
+}
+
+// Whether a started warm build for |path| should be abandoned: memory is
+// short, the user is waiting for completion or diagnostics, or its session
+// has been evicted.
+bool warmInterrupted(SemaManager *manager, const std::string &path) {
+  if (memoryShort() || !manager->comp_tasks.isEmpty() ||
+      !manager->diag_tasks.isEmpty())
+    return true;
+  std::lock_guard lock(manager->mutex);
+  return !manager->sessions.has(path);
+}
+
+// Returns false if a warm build was abandoned.
+bool buildPreamble(SemaManager *manager, Session &session,
+                   CompilerInvocation &ci,
                    IntrusiveRefCntPtr<llvm::vfs::FileSystem> fs,
                    const SemaManager::PreambleTask &task,
                    std::unique_ptr<PreambleStatCache> stat_cache) {
   std::shared_ptr<PreambleData> oldP = session.getPreamble();
   std::string content = session.wfiles->getContent(task.path);
+  if (task.warm)
+    if (std::optional<std::string> disk = readContent(task.path))
+      content = std::move(*disk);
   std::unique_ptr<llvm::MemoryBuffer> buf =
       llvm::MemoryBuffer::getMemBuffer(content);
   auto bounds = ComputePreambleBounds(*ci.getLangOpts(), buf.get(), 0);
   if (!task.from_diag && oldP &&
       oldP->preamble.CanReuse(ci, buf.get(), bounds, fs.get()))
-    return;
+    return true;
   // -Werror makes warnings issued as errors, which stops parsing
   // prematurely because of -ferror-limit=. This also works around the issue
   // of -Werror + -Wunused-parameter in interaction with SkipFunctionBodies.
@@ -375,6 +473,9 @@ void buildPreamble(Session &session, CompilerInvocation &ci,
             llvm::MemoryBuffer::getMemBufferCopy(wf->buffer_content).release());
   }
 
+  // The build cannot be interrupted, so check last thing before it.
+  if (task.warm && warmInterrupted(manager, task.path))
+    return false;
   CclsPreambleCallbacks pc;
   if (auto newPreamble = PrecompiledPreamble::Build(
           ci, buf.get(), bounds, *de, fs, session.pch, true, pc)) {
@@ -398,6 +499,20 @@ void buildPreamble(Session &session, CompilerInvocation &ci,
         std::move(*newPreamble), std::move(pc.includes), dc.take(),
         std::move(stat_cache));
   }
+  return true;
+}
+
+// Whether a speculative preamble build for |path| fits in the budget.
+bool shouldWarm(SemaManager *manager, const std::string &path) {
+  // Related files are guessed by SemaManager::warm without checking that they
+  // exist.
+  if (memoryShort() || !sys::fs::exists(path))
+    return false;
+  std::lock_guard lock(manager->mutex);
+  auto &sessions = manager->sessions;
+  return !sessions.has(path) && !sessions.full() &&
+         sessions.count([](const Session &s) { return s.warm; }) <
+             g_config->session.warmup;
 }
 
 void *preambleMain(void *manager_) {
@@ -407,19 +522,34 @@ void *preambleMain(void *manager_) {
     SemaManager::PreambleTask task = manager->preamble_tasks.dequeue();
     if (pipeline::g_quit.load(std::memory_order_relaxed))
       break;
+    if (task.warm && !shouldWarm(manager, task.path)) {
+      manager->warm_cancelled++;
+      continue;
+    }
 
     bool created = false;
     std::shared_ptr<Session> session =
-        manager->ensureSession(task.path, &created);
+        manager->ensureSession(task.path, &created, task.warm);
 
     auto stat_cache = std::make_unique<PreambleStatCache>();
     IntrusiveRefCntPtr<llvm::vfs::FileSystem> fs =
         stat_cache->producer(session->fs);
+    bool built = true;
     if (std::unique_ptr<CompilerInvocation> ci =
             buildCompilerInvocation(task.path, session->file.args, fs))
-      buildPreamble(*session, *ci, fs, task, std::move(stat_cache));
+      built = buildPreamble(manager, *session, *ci, fs, task,
+                            std::move(stat_cache));
 
-    if (task.comp_task) {
+    if (task.warm) {
+      if (built) {
+        manager->warm_builds++;
+      } else {
+        manager->warm_cancelled++;
+        std::lock_guard lock(manager->mutex);
+        manager->sessions.takeIf(
+            [&](const Session &s) { return s.warm && &s == session.get(); });
+      }
+    } else if (task.comp_task) {
       manager->comp_tasks.pushBack(std::move(task.comp_task));
     } else if (task.from_diag) {
       manager->scheduleDiag(task.path, 0);
@@ -527,6 +657,141 @@ void printDiag(llvm::raw_string_ostream &os, const DiagBase &d) {
   os << diagLeveltoString(d.level) << ": " << d.message;
 }
 
+// Hash the token sequence of |content|, ignoring whitespace and comments (but
+// not doc comments if |doc|), and record the start of each token. Line breaks
+// between tokens and leading indentation are hashed, as they can change
+// diagnostics (e.g. -Wmisleading-indentation), and so are the lines of
+// __LINE__. Spacing is significant in preprocessor directives and hashed there.
+uint64_t tokenFingerprint(const LangOptions &lo, StringRef content, bool doc,
+                          std::vector<Position> &tokens) {
+  Lexer lex(SourceLocation(), lo, content.begin(), content.begin(),
+            content.end());
+  lex.SetCommentRetentionState(doc);
+  llvm::hash_code hash = 0;
+  Position pos;
+  const char *p = content.begin();
+  bool directive = false;
+  Token tok;
+  while (true) {
+    lex.LexFromRawLexer(tok);
+    if (tok.is(tok::eof))
+      break;
+    if (tok.isAtStartOfLine())
+      directive = tok.is(tok::hash);
+    StringRef text(lex.getBufferLocation() - tok.getLength(), tok.getLength());
+    if (tok.is(tok::comment) &&
+        !(text.startswith("///") || text.startswith("//!") ||
+          text.startswith("/**") || text.startswith("/*!")))
+      continue;
+    // Columns are in UTF-16 code units. Skip UTF-8 continuation bytes and
+    // count 4-byte sequences as surrogate pairs.
+    for (; p < text.begin(); p++)
+      if (*p == '\n') {
+        pos.line++;
+        pos.character = 0;
+      } else if ((uint8_t(*p) & 0xc0) != 0x80) {
+        pos.character += uint8_t(*p) >= 0xf0 ? 2 : 1;
+      }
+    tokens.push_back(pos);
+    int flags = tok.isAtStartOfLine();
+    if (directive)
+      flags |= tok.hasLeadingSpace() << 1;
+    int indent = tok.isAtStartOfLine() ? pos.character : -1;
+    int line = text == "__LINE__" ? pos.line : -1;
+    hash = llvm::hash_combine(hash, text, flags, indent, line);
+  }
+  return hash;
+}
+
+// Map |pos| relative to the token sequence |from| to the equivalent position
+// in |to|.
+void remapPosition(Position &pos, const std::vector<Position> &from,
+                   const std::vector<Position> &to) {
+  auto it = std::upper_bound(from.begin(), from.end(), pos);
+  if (it == from.begin())
+    return;
+  const Position &old = *--it, &cur = to[it - from.begin()];
+  if (pos.line == old.line)
+    pos.character += cur.character - old.character;
+  pos.line += cur.line - old.line;
+}
+
+void remapPos(Pos &pos, const std::vector<Position> &from,
+              const std::vector<Position> &to) {
+  Position pos1{pos.line, pos.column};
+  remapPosition(pos1, from, to);
+  pos.line = pos1.line;
+  pos.column = pos1.character;
+}
+
+std::vector<Diagnostic> toDiagnostics(const std::vector<Diag> &diags) {
+  auto fill = [](const DiagBase &d, Diagnostic &ret) {
+    ret.range = lsRange{{d.range.start.line, d.range.start.column},
+                        {d.range.end.line, d.range.end.column}};
+    switch (d.level) {
+    case DiagnosticsEngine::Ignored:
+      // llvm_unreachable
+    case DiagnosticsEngine::Remark:
+      ret.severity = 4;
+      break;
+    case DiagnosticsEngine::Note:
+      ret.severity = 3;
+      break;
+    case DiagnosticsEngine::Warning:
+      ret.severity = 2;
+      break;
+    case DiagnosticsEngine::Error:
+    case DiagnosticsEngine::Fatal:
+      ret.severity = 1;
+      break;
+    }
+    ret.code = (int)d.category;
+    return ret;
+  };
+
+  std::vector<Diagnostic> ls_diags;
+  for (auto &d : diags) {
+    if (!d.concerned)
+      continue;
+    Diagnostic &ls_diag = ls_diags.emplace_back();
+    fill(d, ls_diag);
+    ls_diag.fixits_ = d.edits;
+    if (g_config->client.diagnosticsRelatedInformation) {
+      ls_diag.message = d.message;
+      for (const Note &n : d.notes) {
+        SmallString<256> str(n.file);
+        llvm::sys::path::remove_dots(str, true);
+        Location loc{DocumentUri::fromPath(str.str()),
+                     lsRange{{n.range.start.line, n.range.start.column},
+                             {n.range.end.line, n.range.end.column}}};
+        ls_diag.relatedInformation.push_back({loc, n.message});
+      }
+    } else {
+      std::string buf;
+      llvm::raw_string_ostream os(buf);
+      os << d.message;
+      for (const Note &n : d.notes) {
+        os << "\n\n";
+        printDiag(os, n);
+      }
+      os.flush();
+      ls_diag.message = std::move(buf);
+      for (const Note &n : d.notes) {
+        if (!n.concerned)
+          continue;
+        Diagnostic &ls_diag1 = ls_diags.emplace_back();
+        fill(n, ls_diag1);
+        buf.clear();
+        os << n.message << "\n\n";
+        printDiag(os, d);
+        os.flush();
+        ls_diag1.message = std::move(buf);
+      }
+    }
+  }
+  return ls_diags;
+}
+
 void *diagnosticMain(void *manager_) {
   auto *manager = static_cast<SemaManager *>(manager_);
   set_thread_name("diag");
@@ -563,100 +828,153 @@ void *diagnosticMain(void *manager_) {
       }
     }
 
+    auto start = chrono::steady_clock::now();
+    std::string content;
+    std::vector<std::pair<int, int>> regions, skipped;
+    std::vector<Diagnostic> carried;
+    bool complete = false, region_mode = false;
+    {
+      std::lock_guard lock(manager->wfiles->mutex);
+      if (WorkingFile *wf = manager->wfiles->getFileUnlocked(task.path)) {
+        content = wf->buffer_content;
+        complete = wf->diagnostics_complete;
+        int threshold = g_config->diagnostics.regionThreshold;
+        region_mode = threshold > 0 &&
+                      (int)wf->buffer_lines.size() >= threshold &&
+                      wf->diagnostics_complete && wf->edited_lines.size();
+        regions = std::move(wf->edited_lines);
+        wf->edited_lines.clear();
+        if (region_mode)
+          carried = wf->diagnostics;
+        wf->diagnosing = true;
+        wf->line_edits.clear();
+        // Cleared edited lines make the next region parse incomplete unless
+        // this one succeeds.
+        wf->diagnostics_complete = false;
+      }
+    }
+
     std::unique_ptr<CompilerInvocation> ci =
         buildCompilerInvocation(task.path, session->file.args, fs);
     if (!ci)
       continue;
+
+    // If the buffer is token-equivalent to the one last diagnosed with the
+    // same preamble, re-map and republish the previous diagnostics.
+    bool doc = false;
+    for (const char *arg : session->file.args)
+      if (StringRef(arg).startswith("-Wdocumentation") ||
+          StringRef(arg) == "-Weverything")
+        doc = true;
+    std::vector<Position> tokens;
+    uint64_t hash = tokenFingerprint(*ci->getLangOpts(), content, doc, tokens);
+    Session::DiagCache &cache = session->diag_cache;
+    if (complete && hash == cache.hash &&
+        tokens.size() == cache.tokens.size() &&
+        cache.preamble.lock() == preamble) {
+      // Remap the clang diagnostics and notes in the main file, then rebuild
+      // the messages, which may quote note positions.
+      for (Diag &d : cache.diags) {
+        remapPos(d.range.start, cache.tokens, tokens);
+        remapPos(d.range.end, cache.tokens, tokens);
+        for (Note &n : d.notes)
+          if (n.concerned) {
+            remapPos(n.range.start, cache.tokens, tokens);
+            remapPos(n.range.end, cache.tokens, tokens);
+          }
+        for (TextEdit &edit : d.edits) {
+          remapPosition(edit.range.start, cache.tokens, tokens);
+          remapPosition(edit.range.end, cache.tokens, tokens);
+        }
+      }
+      cache.tokens = std::move(tokens);
+      std::vector<Diagnostic> ls_diags = toDiagnostics(cache.diags);
+      {
+        std::lock_guard lock(manager->wfiles->mutex);
+        if (WorkingFile *wf = manager->wfiles->getFileUnlocked(task.path)) {
+          wf->diagnostics_complete = wf->setDiagnostics(std::move(ls_diags));
+          ls_diags = wf->diagnostics;
+        }
+      }
+      manager->on_diagnostic_(task.path, ls_diags);
+      manager->skipped_diag_runs++;
+      continue;
+    }
+
     // If main file is a header, add -Wno-unused-function
     if (lookupExtension(session->file.filename).second)
       ci->getDiagnosticOpts().Warnings.push_back("no-unused-function");
     ci->getDiagnosticOpts().IgnoreWarnings = false;
-    ci->getFrontendOpts().SkipFunctionBodies = false;
+    ci->getFrontendOpts().SkipFunctionBodies = region_mode;
+    if (region_mode) {
+      // Uses in skipped bodies are not seen.
+      auto &ws = ci->getDiagnosticOpts().Warnings;
+      for (const char *w :
+           {"no-unused-function", "no-unused-member-function",
+            "no-unused-private-field", "no-unused-const-variable",
+            "no-unneeded-internal-declaration"})
+        ws.push_back(w);
+    }
     ci->getLangOpts()->SpellChecking = g_config->diagnostics.spellChecking;
     StoreDiags dc(task.path);
-    std::string content = manager->wfiles->getContent(task.path);
     auto buf = llvm::MemoryBuffer::getMemBuffer(content);
     auto clang = buildCompilerInstance(*session, std::move(ci), fs, dc,
                                        preamble.get(), task.path, buf);
     if (!clang)
       continue;
-    if (!parse(*clang))
+    if (region_mode) {
+      RegionAction action(regions, skipped);
+      if (!parse(*clang, action))
+        continue;
+    } else if (!parse(*clang)) {
       continue;
-
-    auto fill = [](const DiagBase &d, Diagnostic &ret) {
-      ret.range = lsRange{{d.range.start.line, d.range.start.column},
-                          {d.range.end.line, d.range.end.column}};
-      switch (d.level) {
-      case DiagnosticsEngine::Ignored:
-        // llvm_unreachable
-      case DiagnosticsEngine::Remark:
-        ret.severity = 4;
-        break;
-      case DiagnosticsEngine::Note:
-        ret.severity = 3;
-        break;
-      case DiagnosticsEngine::Warning:
-        ret.severity = 2;
-        break;
-      case DiagnosticsEngine::Error:
-      case DiagnosticsEngine::Fatal:
-        ret.severity = 1;
-        break;
-      }
-      ret.code = (int)d.category;
-      return ret;
-    };
+    }
 
     std::vector<Diag> diags = dc.take();
     if (std::shared_ptr<PreambleData> preamble = session->getPreamble())
       diags.insert(diags.end(), preamble->diags.begin(), preamble->diags.end());
-    std::vector<Diagnostic> ls_diags;
-    for (auto &d : diags) {
-      if (!d.concerned)
-        continue;
-      Diagnostic &ls_diag = ls_diags.emplace_back();
-      fill(d, ls_diag);
-      ls_diag.fixits_ = d.edits;
-      if (g_config->client.diagnosticsRelatedInformation) {
-        ls_diag.message = d.message;
-        for (const Note &n : d.notes) {
-          SmallString<256> str(n.file);
-          llvm::sys::path::remove_dots(str, true);
-          Location loc{DocumentUri::fromPath(str.str()),
-                       lsRange{{n.range.start.line, n.range.start.column},
-                               {n.range.end.line, n.range.end.column}}};
-          ls_diag.relatedInformation.push_back({loc, n.message});
-        }
-      } else {
-        std::string buf;
-        llvm::raw_string_ostream os(buf);
-        os << d.message;
-        for (const Note &n : d.notes) {
-          os << "\n\n";
-          printDiag(os, n);
-        }
-        os.flush();
-        ls_diag.message = std::move(buf);
-        for (const Note &n : d.notes) {
-          if (!n.concerned)
-            continue;
-          Diagnostic &ls_diag1 = ls_diags.emplace_back();
-          fill(n, ls_diag1);
-          buf.clear();
-          os << n.message << "\n\n";
-          printDiag(os, d);
-          os.flush();
-          ls_diag1.message = std::move(buf);
-        }
-      }
-    }
+    diags.erase(std::remove_if(diags.begin(), diags.end(),
+                               [](const Diag &d) { return !d.concerned; }),
+                diags.end());
+    std::vector<Diagnostic> ls_diags = toDiagnostics(diags);
 
+    // Carry over diagnostics in function bodies that were not parsed. Both
+    // |carried| and |skipped| are relative to the snapshot.
+    for (Diagnostic &d : carried)
+      for (auto &r : skipped)
+        if (r.first <= d.range.start.line && d.range.start.line <= r.second) {
+          ls_diags.push_back(d);
+          break;
+        }
+    // Diagnostics carried over from a region parse cannot be rebuilt.
+    cache.hash = region_mode ? 0 : hash;
+    cache.tokens = std::move(tokens);
+    cache.preamble = preamble;
+    cache.diags = std::move(diags);
     {
       std::lock_guard lock(manager->wfiles->mutex);
-      if (WorkingFile *wf = manager->wfiles->getFileUnlocked(task.path))
-        wf->diagnostics = ls_diags;
+      if (WorkingFile *wf = manager->wfiles->getFileUnlocked(task.path)) {
+        // Move the diagnostics past lines edited during the parse. Warnings
+        // that need the whole translation unit are off in region mode, so the
+        // next run is a full parse.
+        bool ok = wf->setDiagnostics(std::move(ls_diags));
+        wf->diagnostics_complete = ok && !region_mode;
+        ls_diags = wf->diagnostics;
+      }
     }
     manager->on_diagnostic_(task.path, ls_diags);
+    // Bring the warnings back once editing pauses.
+    if (region_mode)
+      manager->scheduleDiag(task.path,
+                            std::max(g_config->diagnostics.onChange, 0));
+
+    int64_t ms = chrono::duration_cast<chrono::milliseconds>(
+                     chrono::steady_clock::now() - start)
+                     .count();
+    (region_mode ? manager->region_diag_runs : manager->full_diag_runs)++;
+    (region_mode ? manager->region_diag_ms : manager->full_diag_ms) += ms;
+    LOG_V(1) << (region_mode ? "region" : "full") << " diagnostics for "
+             << task.path << " took " << ms << "ms";
   }
   pipeline::threadLeave();
   return nullptr;
@@ -705,11 +1023,18 @@ void SemaManager::scheduleDiag(const std::string &path, int debounce) {
 
 void SemaManager::onView(const std::string &path) {
   std::lock_guard lock(mutex);
-  if (!sessions.get(path))
+  std::shared_ptr<ccls::Session> session = sessions.get(path);
+  if (!session || session->warm)
     preamble_tasks.pushBack(PreambleTask{path}, true);
 }
 
 void SemaManager::onSave(const std::string &path) {
+  {
+    // Force a full diagnostic parse.
+    std::lock_guard lock(wfiles->mutex);
+    if (WorkingFile *wf = wfiles->getFileUnlocked(path))
+      wf->diagnostics_complete = false;
+  }
   preamble_tasks.pushBack(PreambleTask{path}, true);
 }
 
@@ -718,13 +1043,40 @@ void SemaManager::onClose(const std::string &path) {
   sessions.take(path);
 }
 
+void SemaManager::warm(const std::vector<std::string> &paths) {
+  // The budget is checked by the preamble thread, which also drops paths that
+  // do not exist.
+  for (auto &path : paths) {
+    PreambleTask task{path};
+    task.warm = true;
+    preamble_tasks.pushBack(std::move(task), false);
+  }
+}
+
 std::shared_ptr<ccls::Session>
-SemaManager::ensureSession(const std::string &path, bool *created) {
+SemaManager::ensureSession(const std::string &path, bool *created, bool warm) {
   std::lock_guard lock(mutex);
   std::shared_ptr<ccls::Session> session = sessions.get(path);
+  if (session && session->warm && !warm) {
+    // The first real use of a warmed session counts as its creation, e.g. for
+    // diagnostics.onOpen.
+    session->warm = false;
+    warm_hits++;
+    if (created)
+      *created = true;
+  }
   if (!session) {
+    // Warmed sessions make way for viewed files first.
+    if (!warm && sessions.full())
+      sessions.takeIf([](const ccls::Session &s) { return s.warm; });
     session = std::make_shared<ccls::Session>(
         project_->findEntry(path, false, false), wfiles, pch);
+    session->warm = warm;
+    live_sessions.erase(
+        std::remove_if(live_sessions.begin(), live_sessions.end(),
+                       [](auto &s) { return s.expired(); }),
+        live_sessions.end());
+    live_sessions.push_back(session);
     std::string line;
     if (LOG_V_ENABLED(1)) {
       line = "\n ";
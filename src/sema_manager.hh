@@ -14,6 +14,7 @@
 #include <clang/Sema/CodeCompleteOptions.h>
 
 #include <algorithm>
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <mutex>
@@ -65,6 +66,27 @@ template <typename K, typename V> struct LruCache {
       items.pop_back();
     items.emplace(items.begin(), key, std::move(value));
   }
+  // Removes the least recently used value satisfying |pred|.
+  template <typename Fn> std::shared_ptr<V> takeIf(Fn &&pred) {
+    for (auto it = items.rbegin(); it != items.rend(); ++it)
+      if (pred(*it->second)) {
+        auto x = std::move(it->second);
+        items.erase(std::next(it).base());
+        return x;
+      }
+    return nullptr;
+  }
+  template <typename Fn> int count(Fn &&pred) const {
+    return (int)std::count_if(items.begin(), items.end(),
+                              [&](auto &item) { return pred(*item.second); });
+  }
+  bool has(const K &key) const {
+    for (auto &item : items)
+      if (item.first == key)
+        return true;
+    return false;
+  }
+  bool full() const { return (int)items.size() >= capacity; }
   void clear() { items.clear(); }
   void setCapacity(int cap) { capacity = cap; }
 
@@ -80,12 +102,24 @@ struct Session {
   Project::Entry file;
   WorkingFiles *wfiles;
   bool inferred = false;
+  // Created by SemaManager::warm and not viewed yet. Guarded by
+  // SemaManager::mutex.
+  bool warm = false;
 
   // TODO share
   llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> fs =
       llvm::vfs::getRealFileSystem();
   std::shared_ptr<clang::PCHContainerOperations> pch;
 
+  // The last diagnosed buffer, used to skip reparses after edits that only
+  // touch whitespace or comments. Accessed by the diagnostic thread only.
+  struct DiagCache {
+    uint64_t hash = 0;
+    std::vector<Position> tokens;
+    std::weak_ptr<PreambleData> preamble;
+    std::vector<Diag> diags;
+  } diag_cache;
+
   Session(const Project::Entry &file, WorkingFiles *wfiles,
           std::shared_ptr<clang::PCHContainerOperations> pch)
       : file(file), wfiles(wfiles), pch(pch) {}
@@ -125,6 +159,7 @@ struct SemaManager {
     std::string path;
     std::unique_ptr<CompTask> comp_task;
     bool from_diag = false;
+    bool warm = false;
   };
 
   SemaManager(Project *project, WorkingFiles *wfiles,
@@ -134,8 +169,11 @@ struct SemaManager {
   void onView(const std::string &path);
   void onSave(const std::string &path);
   void onClose(const std::string &path);
+  // Queues low priority preamble builds for files likely to be opened next.
+  void warm(const std::vector<std::string> &paths);
   std::shared_ptr<ccls::Session> ensureSession(const std::string &path,
-                                               bool *created = nullptr);
+                                               bool *created = nullptr,
+                                               bool warm = false);
   void clear();
   void quit();
 
@@ -147,6 +185,9 @@ struct SemaManager {
 
   std::mutex mutex;
   LruCache<std::string, ccls::Session> sessions;
+  // All live sessions, including those evicted from |sessions| that a worker
+  // thread still holds. Guarded by |mutex|.
+  std::vector<std::weak_ptr<ccls::Session>> live_sessions;
 
   std::mutex diag_mutex;
   std::unordered_map<std::string, int64_t> next_diag;
@@ -156,6 +197,17 @@ struct SemaManager {
   ThreadedQueue<PreambleTask> preamble_tasks;
 
   std::shared_ptr<clang::PCHContainerOperations> pch;
+
+  // Number and total latency of diagnostic parses of whole files and of
+  // regions (diagnostics.regionThreshold).
+  std::atomic<int64_t> full_diag_runs{0}, full_diag_ms{0};
+  std::atomic<int64_t> region_diag_runs{0}, region_diag_ms{0};
+  // Number of diagnostic parses skipped because the buffer was
+  // token-equivalent to the one last diagnosed.
+  std::atomic<int64_t> skipped_diag_runs{0};
+  // Preambles built by warm, warmed sessions later viewed, and warm builds
+  // dropped for lack of budget.
+  std::atomic<int64_t> warm_builds{0}, warm_hits{0}, warm_cancelled{0};
 };
 
 // Cached completion information, so we can give fast completion results when
@@ -14,6 +14,7 @@
 #include <llvm/ADT/CachedHashString.h>
 #include <llvm/ADT/DenseSet.h>
 #include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/StringMap.h>
 
 #include <mutex>
 #include <stdexcept>
@@ -402,27 +403,69 @@ void reflectMemberStart(JsonReader &vis) {
     throw std::invalid_argument("object");
 }
 
-static BumpPtrAllocator alloc;
-static DenseSet<CachedHashStringRef> strings;
+// Interned strings mapped to the generation in which they were last interned
+// or found reachable by collectInterned. Entries are allocated individually so
+// that erasing one returns its memory.
+static StringMap<uint32_t> strings;
+static uint32_t generation = 0;
+static size_t interned_bytes = 0;
 static std::mutex allocMutex;
 
 CachedHashStringRef internH(StringRef s) {
   if (s.empty())
     s = "";
-  CachedHashString hs(s);
-  std::lock_guard lock(allocMutex);
-  auto r = strings.insert(hs);
-  if (r.second) {
-    char *p = alloc.Allocate<char>(s.size() + 1);
-    memcpy(p, s.data(), s.size());
-    p[s.size()] = '\0';
-    *r.first = CachedHashStringRef(StringRef(p, s.size()), hs.hash());
+  StringRef key;
+  {
+    std::lock_guard lock(allocMutex);
+    auto r = strings.try_emplace(s, generation);
+    if (r.second)
+      interned_bytes += s.size() + 1;
+    else
+      r.first->second = generation;
+    key = r.first->getKey();
   }
-  return *r.first;
+  return CachedHashStringRef(key);
 }
 
 const char *intern(StringRef s) { return internH(s).val().data(); }
 
+std::pair<size_t, size_t> internedSize() {
+  std::lock_guard lock(allocMutex);
+  return {strings.size(), interned_bytes};
+}
+
+std::pair<size_t, size_t>
+collectInterned(function_ref<void(function_ref<void(const char *)>)> roots) {
+  uint32_t gen;
+  {
+    std::lock_guard lock(allocMutex);
+    gen = ++generation;
+  }
+  // Call |roots| without the lock as it may take locks held by threads that
+  // intern strings.
+  DenseSet<const char *> live;
+  roots([&](const char *p) { live.insert(p); });
+
+  size_t n = 0, bytes = 0;
+  std::lock_guard lock(allocMutex);
+  for (auto it = strings.begin(), ie = strings.end(); it != ie;) {
+    auto cur = it++;
+    // Strings interned since the previous collection may still be held by
+    // threads that have not published them.
+    if (gen - cur->second <= 1)
+      continue;
+    if (live.count(cur->getKey().data())) {
+      cur->second = gen;
+      continue;
+    }
+    n++;
+    bytes += cur->getKey().size() + 1;
+    strings.erase(cur);
+  }
+  interned_bytes -= bytes;
+  return {n, bytes};
+}
+
 std::string serialize(SerializeFormat format, IndexFile &file) {
   switch (format) {
   case SerializeFormat::Binary: {
@@ -397,6 +397,14 @@ void reflectMember(BinaryWriter &vis, const char *, T &v) {
 
 const char *intern(llvm::StringRef str);
 llvm::CachedHashStringRef internH(llvm::StringRef str);
+// Number of interned strings and their total size in bytes.
+std::pair<size_t, size_t> internedSize();
+// Frees interned strings that have been neither interned nor reported by
+// |roots| since the call before the previous one. |roots| is called with a
+// function to report a live string and must report every string referenced by
+// long-lived state. Returns the number of strings and bytes freed.
+std::pair<size_t, size_t> collectInterned(
+    llvm::function_ref<void(llvm::function_ref<void(const char *)>)> roots);
 std::string serialize(SerializeFormat format, IndexFile &file);
 std::unique_ptr<IndexFile>
 deserialize(SerializeFormat format, const std::string &path,
@@ -20,18 +20,64 @@
 #include <errno.h>
 #include <functional>
 #include <regex>
+#include <shared_mutex>
 #include <string.h>
 #include <unordered_map>
 
 using namespace llvm;
 
 namespace ccls {
+namespace {
+bool equalsLower(const char *s, const std::string &lower) {
+  for (size_t i = 0; i < lower.size(); i++)
+    if ((char)tolower((unsigned char)s[i]) != lower[i])
+      return false;
+  return true;
+}
+} // namespace
+
 struct Matcher::Impl {
+  // Most patterns are paths such as ^/usr/include/ or \.pb\.cc$. They
+  // are matched as case-insensitive literals instead of with std::regex.
+  enum Kind { Regex, Substring, Prefix, Suffix, Exact } kind = Regex;
+  std::string literal; // lowercased
   std::regex regex;
+
+  bool parseLiteral(const std::string &pattern);
 };
 
+bool Matcher::Impl::parseLiteral(const std::string &pattern) {
+  bool begin = false, end = false;
+  size_t i = 0, n = pattern.size();
+  if (n && pattern[0] == '^')
+    begin = true, i = 1;
+  for (; i < n; i++) {
+    char c = pattern[i];
+    if (c == '\\') {
+      // Identity escapes of punctuation are literal; \d, \b, \1, etc. are
+      // not.
+      if (i + 1 == n || isalnum((unsigned char)pattern[i + 1]) ||
+          pattern[i + 1] == '_')
+        return false;
+      c = pattern[++i];
+    } else if (c == '$' && i + 1 == n) {
+      end = true;
+      break;
+    } else if (strchr("^$.*+?()[]{}|", c)) {
+      return false;
+    }
+    literal += (char)tolower((unsigned char)c);
+  }
+  kind = begin ? (end ? Exact : Prefix) : (end ? Suffix : Substring);
+  return true;
+}
+
 Matcher::Matcher(const std::string &pattern)
     : impl(std::make_unique<Impl>()), pattern(pattern) {
+  if (impl->parseLiteral(pattern))
+    return;
+  impl->kind = Impl::Regex;
+  impl->literal.clear();
   impl->regex = std::regex(pattern, std::regex_constants::ECMAScript |
                                         std::regex_constants::icase |
                                         std::regex_constants::optimize);
@@ -40,9 +86,29 @@ Matcher::Matcher(const std::string &pattern)
 Matcher::~Matcher() {}
 
 bool Matcher::matches(const std::string &text) const {
-  return std::regex_search(text, impl->regex, std::regex_constants::match_any);
+  const std::string &lit = impl->literal;
+  switch (impl->kind) {
+  case Impl::Regex:
+    return std::regex_search(text, impl->regex,
+                             std::regex_constants::match_any);
+  case Impl::Substring:
+    for (size_t i = 0; i + lit.size() <= text.size(); i++)
+      if (equalsLower(text.data() + i, lit))
+        return true;
+    return false;
+  case Impl::Prefix:
+    return text.size() >= lit.size() && equalsLower(text.data(), lit);
+  case Impl::Suffix:
+    return text.size() >= lit.size() &&
+           equalsLower(text.data() + text.size() - lit.size(), lit);
+  case Impl::Exact:
+    return text.size() == lit.size() && equalsLower(text.data(), lit);
+  }
+  return false;
 }
 
+bool Matcher::isRegex() const { return impl->kind == Impl::Regex; }
+
 GroupMatch::GroupMatch(const std::vector<std::string> &whitelist,
                        const std::vector<std::string> &blacklist) {
   auto err = [](const std::string &pattern, const char *what) {
@@ -66,20 +132,48 @@ GroupMatch::GroupMatch(const std::vector<std::string> &whitelist,
       err(pattern, e.what());
     }
   }
+  for (auto *list : {&this->whitelist, &this->blacklist})
+    for (const Matcher &m : *list)
+      memoize |= m.isRegex();
 }
 
-bool GroupMatch::matches(const std::string &text,
-                         std::string *blacklist_pattern) const {
+int GroupMatch::match(const std::string &text) const {
   for (const Matcher &m : whitelist)
     if (m.matches(text))
-      return true;
-  for (const Matcher &m : blacklist)
-    if (m.matches(text)) {
-      if (blacklist_pattern)
-        *blacklist_pattern = m.pattern;
-      return false;
+      return -1;
+  for (int i = 0; i < (int)blacklist.size(); i++)
+    if (blacklist[i].matches(text))
+      return i;
+  return -1;
+}
+
+bool GroupMatch::matches(const std::string &text,
+                         std::string *blacklist_pattern) const {
+  if (whitelist.empty() && blacklist.empty())
+    return true;
+  int i;
+  if (!memoize) {
+    i = match(text);
+  } else {
+    {
+      std::lock_guard lock(mutex);
+      auto it = memo.find(text);
+      i = it != memo.end() ? it->second : -2;
     }
-  return true;
+    if (i == -2) {
+      i = match(text);
+      std::lock_guard lock(mutex);
+      // Bound the memory used by one-off paths.
+      if (memo.size() >= 1 << 16)
+        memo.clear();
+      memo.emplace(text, i);
+    }
+  }
+  if (i < 0)
+    return true;
+  if (blacklist_pattern)
+    *blacklist_pattern = blacklist[i].pattern;
+  return false;
 }
 
 uint64_t hashUsr(llvm::StringRef s) {
@@ -131,12 +225,96 @@ std::string resolveIfRelative(const std::string &directory,
   return normalizePath(ret.str());
 }
 
-std::string realPath(const std::string &path) {
+std::atomic<int64_t> real_path_calls{0}, real_path_resolves{0};
+
+namespace {
+struct RealPathCache {
+  // Both maps are cleared when one reaches this size.
+  static constexpr size_t kMaxEntries = 1 << 18;
+  std::shared_mutex mutex;
+  std::unordered_map<std::string, std::string> dirs, files;
+
+  void insert(std::unordered_map<std::string, std::string> &map,
+              const std::string &key, const std::string &value) {
+    std::unique_lock lock(mutex);
+    if (map.size() >= kMaxEntries) {
+      dirs.clear();
+      files.clear();
+    }
+    map.emplace(key, value);
+  }
+} real_path_cache;
+
+// Whether |path| is |prefix| or under it.
+bool isUnder(StringRef path, StringRef prefix) {
+  if (!path.startswith(prefix))
+    return false;
+  return path.size() == prefix.size() || prefix.empty() ||
+         prefix.back() == '/' || path[prefix.size()] == '/';
+}
+
+std::string resolveRealPath(const std::string &path) {
+  real_path_resolves++;
   SmallString<256> buf;
   sys::fs::real_path(path, buf);
   return buf.empty() ? path : llvm::sys::path::convert_to_slash(buf);
 }
 
+std::string realDir(const std::string &dir) {
+  auto &c = real_path_cache;
+  {
+    std::shared_lock lock(c.mutex);
+    auto it = c.dirs.find(dir);
+    if (it != c.dirs.end())
+      return it->second;
+  }
+  std::string ret = resolveRealPath(dir);
+  c.insert(c.dirs, dir, ret);
+  return ret;
+}
+} // namespace
+
+std::string realPath(const std::string &path) {
+  real_path_calls++;
+  auto &c = real_path_cache;
+  {
+    std::shared_lock lock(c.mutex);
+    auto it = c.files.find(path);
+    if (it != c.files.end())
+      return it->second;
+  }
+  std::string ret;
+  StringRef dir = sys::path::parent_path(path),
+            name = sys::path::filename(path);
+  sys::fs::file_status status;
+  // Directories, symbolic links and missing files are resolved as a whole.
+  if (dir.size() && name != "." && name != ".." &&
+      !sys::fs::status(path, status, false) &&
+      status.type() == sys::fs::file_type::regular_file) {
+    ret = realDir(dir.str());
+    if (ret.empty() || ret.back() != '/')
+      ret += '/';
+    ret += name.str();
+  } else {
+    ret = resolveRealPath(path);
+  }
+  c.insert(c.files, path, ret);
+  return ret;
+}
+
+void invalidateRealPath(const std::string &path) {
+  auto &c = real_path_cache;
+  std::unique_lock lock(c.mutex);
+  // Keys are the paths callers passed in while events may name the target of
+  // a symbolic link, so match resolved paths as well.
+  for (auto *map : {&c.dirs, &c.files})
+    for (auto it = map->begin(); it != map->end();)
+      if (isUnder(it->first, path) || isUnder(it->second, path))
+        it = map->erase(it);
+      else
+        ++it;
+}
+
 bool normalizeFolder(std::string &path) {
   for (auto &[root, real] : g_config->workspaceFolders)
     if (real.size() && llvm::StringRef(path).startswith(real)) {
@@ -6,9 +6,12 @@
 #include <optional>
 #include <string_view>
 
+#include <atomic>
 #include <iterator>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -26,6 +29,9 @@ struct Matcher {
   Matcher(Matcher &&) = default;
   ~Matcher();
   bool matches(const std::string &text) const;
+  // Whether the pattern needs std::regex, i.e. it is not a literal string
+  // optionally anchored by ^ and $.
+  bool isRegex() const;
 };
 
 struct GroupMatch {
@@ -35,6 +41,14 @@ struct GroupMatch {
              const std::vector<std::string> &blacklist);
   bool matches(const std::string &text,
                std::string *blacklist_pattern = nullptr) const;
+
+private:
+  // If some pattern falls back to std::regex, results are memoized per path:
+  // -1 if accepted, otherwise the index of the rejecting blacklist pattern.
+  bool memoize = false;
+  mutable std::mutex mutex;
+  mutable std::unordered_map<std::string, int> memo;
+  int match(const std::string &text) const;
 };
 
 uint64_t hashUsr(llvm::StringRef s);
@@ -50,7 +64,15 @@ std::string escapeFileName(std::string path);
 
 std::string resolveIfRelative(const std::string &directory,
                               const std::string &path);
+// Resolves symbolic links. Results are cached: the directory part of a path
+// is resolved once, and a file that is not a symbolic link itself only costs
+// an lstat.
 std::string realPath(const std::string &path);
+// Drops cached realPath results of |path| and the paths under it, and those
+// resolved to them. An empty |path| clears the cache.
+void invalidateRealPath(const std::string &path);
+// Number of realPath calls, and of sys::fs::real_path calls made for them.
+extern std::atomic<int64_t> real_path_calls, real_path_resolves;
 bool normalizeFolder(std::string &path);
 
 std::optional<int64_t> lastWriteTime(const std::string &path);
@@ -9,6 +9,7 @@
 #include <clang/Basic/CharInfo.h>
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <climits>
 #include <numeric>
@@ -205,11 +206,22 @@ findMatchingLine(const std::vector<std::string> &index_lines,
   return best;
 }
 
+void shiftDiagnostics(std::vector<Diagnostic> &diagnostics, int old_end,
+                      int delta) {
+  for (Diagnostic &d : diagnostics)
+    if (d.range.start.line > old_end) {
+      d.range.start.line += delta;
+      d.range.end.line += delta;
+    }
+}
+
+std::atomic<int64_t> g_edit_seq{0};
 } // namespace
 
 WorkingFile::WorkingFile(const std::string &filename,
                          const std::string &buffer_content)
-    : filename(filename), buffer_content(buffer_content) {
+    : filename(filename), buffer_content(buffer_content),
+      edits_base(++g_edit_seq) {
   onBufferContentUpdated();
 
   // setIndexContent gets called when the file is opened.
@@ -229,6 +241,61 @@ void WorkingFile::onBufferContentUpdated() {
   buffer_to_index.clear();
 }
 
+void WorkingFile::onLinesChanged(int start, int old_end, int new_end) {
+  int delta = new_end - old_end;
+  shiftDiagnostics(diagnostics, old_end, delta);
+  if (diagnosing)
+    line_edits.emplace_back(start, old_end, new_end);
+
+  std::vector<std::pair<int, int>> lines;
+  int lo = start, hi = new_end;
+  for (auto [b, e] : edited_lines)
+    if (b > old_end)
+      lines.emplace_back(b + delta, e + delta);
+    else if (e < start)
+      lines.emplace_back(b, e);
+    else {
+      // Merge overlapping ranges into the edited one.
+      lo = std::min(lo, b);
+      hi = std::max(hi, e + delta);
+    }
+  lines.emplace_back(lo, hi);
+  std::sort(lines.begin(), lines.end());
+  edited_lines = std::move(lines);
+}
+
+void WorkingFile::onEdited(int offset) {
+  edits.emplace_back(++g_edit_seq, offset);
+  if (edits.size() > 32) {
+    edits_base = edits.front().first;
+    edits.pop_front();
+  }
+}
+
+int64_t WorkingFile::editSeq() const {
+  return edits.empty() ? edits_base : edits.back().first;
+}
+
+int WorkingFile::firstEditSince(int64_t seq) const {
+  if (seq < edits_base)
+    return 0;
+  int ret = INT_MAX;
+  for (auto &[seq1, offset] : edits)
+    if (seq1 > seq)
+      ret = std::min(ret, offset);
+  return ret;
+}
+
+bool WorkingFile::setDiagnostics(std::vector<Diagnostic> diagnostics) {
+  for (auto [start, old_end, new_end] : line_edits)
+    shiftDiagnostics(diagnostics, old_end, new_end - old_end);
+  this->diagnostics = std::move(diagnostics);
+  bool ret = diagnosing;
+  diagnosing = false;
+  line_edits.clear();
+  return ret;
+}
+
 // Variant of Paul Heckel's diff algorithm to compute |index_to_buffer| and
 // |buffer_to_index|.
 // The core idea is that if a line is unique in both index and buffer,
@@ -382,6 +449,7 @@ WorkingFile *WorkingFiles::onOpen(const TextDocumentItem &open) {
     wf->version = open.version;
     wf->buffer_content = content;
     wf->onBufferContentUpdated();
+    wf->onEdited(0);
   } else {
     wf = std::make_unique<WorkingFile>(path, content);
   }
@@ -412,6 +480,9 @@ void WorkingFiles::onChange(const TextDocumentDidChangeParam &change) {
     if (!diff.range) {
       file->buffer_content = diff.text;
       file->onBufferContentUpdated();
+      file->onEdited(0);
+      file->diagnostics_complete = false;
+      file->diagnosing = false;
     } else {
       int start_offset =
           getOffsetForPosition(diff.range->start, file->buffer_content);
@@ -423,6 +494,11 @@ void WorkingFiles::onChange(const TextDocumentDidChangeParam &change) {
                                    file->buffer_content.begin() + end_offset,
                                    diff.text);
       file->onBufferContentUpdated();
+      file->onEdited(start_offset);
+      file->onLinesChanged(
+          diff.range->start.line, diff.range->end.line,
+          diff.range->start.line +
+              (int)std::count(diff.text.begin(), diff.text.end(), '\n'));
     }
   }
 }
@@ -6,9 +6,11 @@
 #include "lsp.hh"
 #include "utils.hh"
 
+#include <deque>
 #include <mutex>
 #include <optional>
 #include <string>
+#include <tuple>
 #include <unordered_map>
 
 namespace ccls {
@@ -32,6 +34,19 @@ struct WorkingFile {
   std::vector<int> buffer_to_index;
   // A set of diagnostics that have been reported for this file.
   std::vector<Diagnostic> diagnostics;
+  // Whether |diagnostics| cover the whole buffer, either from a full parse or
+  // from a region parse that kept the diagnostics of the unparsed bodies.
+  bool diagnostics_complete = false;
+  // 0-based line ranges edited since diagnostics were last computed.
+  std::vector<std::pair<int, int>> edited_lines;
+  // Whether diagnostics are being computed from a snapshot of the buffer, and
+  // the onLinesChanged edits (start, old_end, new_end) made since then.
+  bool diagnosing = false;
+  std::vector<std::tuple<int, int, int>> line_edits;
+  // (sequence number, start offset) of the most recent edits. Sequence numbers
+  // are unique across files; those up to |edits_base| have been dropped.
+  std::deque<std::pair<int64_t, int>> edits;
+  int64_t edits_base;
 
   WorkingFile(const std::string &filename, const std::string &buffer_content);
 
@@ -39,6 +54,20 @@ struct WorkingFile {
   void setIndexContent(const std::string &index_content);
   // This should be called whenever |buffer_content| has changed.
   void onBufferContentUpdated();
+  // Lines [start, old_end] have been replaced by [start, new_end]. Shift
+  // |diagnostics| and |edited_lines| below the edit accordingly.
+  void onLinesChanged(int start, int old_end, int new_end);
+  // |buffer_content| has been changed at or after |offset|.
+  void onEdited(int offset);
+  // The sequence number of the last edit, for firstEditSince.
+  int64_t editSeq() const;
+  // The smallest offset edited after |seq|, or INT_MAX if the buffer is
+  // unchanged since then.
+  int firstEditSince(int64_t seq) const;
+  // Shift |diagnostics|, computed from the snapshot taken when |diagnosing|
+  // was set, by |line_edits|, and store them. Returns false if the whole
+  // buffer has been replaced since the snapshot.
+  bool setDiagnostics(std::vector<Diagnostic> diagnostics);
 
   // Finds the buffer line number which maps to index line number |line|.
   // Also resolves |column| if not NULL.